@@ -3,6 +3,7 @@
 #
 #  FFTW_INCLUDES    - where to find fftw3.h
 #  FFTW_LIBRARIES   - List of libraries when using FFTW.
+#  FFTW_MPI_LIBRARIES - the FFTW MPI library (fftw3_mpi) if found.
 #  FFTW_FOUND       - True if FFTW found.
 
 if (FFTW_INCLUDES)
@@ -14,9 +15,12 @@ find_path (FFTW_INCLUDES fftw3.h)
 
 find_library (FFTW_LIBRARIES NAMES fftw3)
 
+# optional, only needed for mincfft_mpi
+find_library (FFTW_MPI_LIBRARIES NAMES fftw3_mpi)
+
 # handle the QUIETLY and REQUIRED arguments and set FFTW_FOUND to TRUE if
 # all listed variables are TRUE
 include (FindPackageHandleStandardArgs)
 find_package_handle_standard_args (FFTW DEFAULT_MSG FFTW_LIBRARIES FFTW_INCLUDES)
 
-mark_as_advanced (FFTW_LIBRARIES FFTW_INCLUDES)
+mark_as_advanced (FFTW_LIBRARIES FFTW_MPI_LIBRARIES FFTW_INCLUDES)
@@ -0,0 +1,412 @@
+/* fft_cache.c */
+/* content addressed cache of mincfft outputs. Each output is stored as  */
+/* <dir>/<key>-<kind>.mnc where key is a hash of the input volume and    */
+/* the options, entries are written to a temporary file and renamed into     */
+/* place so concurrent writers (and readers) never see a partial entry.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <minc2.h>
+#include "fft_cache.h"
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+/* 64 bit FNV-1a */
+#define FNV_OFFSET   0xcbf29ce484222325ULL
+#define FNV_PRIME    0x100000001b3ULL
+
+/* names in a cache directory, anything else is left alone */
+#define CACHE_OTHER  0
+#define CACHE_ENTRY  1               /* <key>-<kind>.mnc        */
+#define CACHE_TMP    2               /* .<key>-<kind>.XXXXXX    */
+
+typedef struct {
+   char    *name;
+   off_t    size;
+   time_t   mtime;
+   } cache_entry;
+
+/* function prototypes */
+static void entry_path(char *path, size_t len, const char *dir, const char *key, int kind);
+static int copy_fd(int in_fd, int out_fd);
+static int cmp_entry_age(const void *a, const void *b);
+static int cache_name_type(const char *name);
+
+void cache_hash_init(uint64_t *hash){
+   *hash = FNV_OFFSET;
+   }
+
+void cache_hash_bytes(uint64_t *hash, const void *buf, size_t len){
+   const unsigned char *p = (const unsigned char *)buf;
+   uint64_t h = *hash;
+   size_t i;
+
+   for(i = 0; i < len; i++){
+      h ^= p[i];
+      h *= FNV_PRIME;
+      }
+   *hash = h;
+   }
+
+/* strings are hashed with their terminator so "ab","c" != "a","bc" */
+void cache_hash_string(uint64_t *hash, const char *str){
+   if(str == NULL){
+      str = "";
+      }
+   cache_hash_bytes(hash, str, strlen(str) + 1);
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : cache_hash_volume
+@INPUT      : hash - running hash
+              fn - MINC file to add
+@RETURNS    : TRUE on success
+@DESCRIPTION: hashes the geometry (dimension names, sizes, starts, steps and
+              direction cosines) and the real voxel values of a volume, a
+              slice at a time. Attributes such as the history are left out
+              so a rerun upstream that writes the same voxels still hits.
+ */
+int cache_hash_volume(uint64_t *hash, const char *fn){
+   mihandle_t    vol;
+   midimhandle_t dims[MI2_MAX_VAR_DIMS];
+   misize_t      sizes[MI2_MAX_VAR_DIMS];
+   misize_t      start[MI2_MAX_VAR_DIMS];
+   misize_t      count[MI2_MAX_VAR_DIMS];
+   double        starts[MI2_MAX_VAR_DIMS];
+   double        steps[MI2_MAX_VAR_DIMS];
+   double        dircos[3];
+   double       *slice;
+   char         *name;
+   size_t        slice_len;
+   misize_t      i;
+   int           n_dims, c, ok;
+
+   if(miopen_volume(fn, MI2_OPEN_READ, &vol) != MI_NOERROR){
+      return FALSE;
+      }
+
+   ok = (miget_volume_dimension_count(vol, MI_DIMCLASS_ANY, MI_DIMATTR_ALL, &n_dims) == MI_NOERROR &&
+         n_dims > 0 && n_dims <= MI2_MAX_VAR_DIMS &&
+         miget_volume_dimensions(vol, MI_DIMCLASS_ANY, MI_DIMATTR_ALL, MI_DIMORDER_FILE,
+                                 n_dims, dims) == MI_NOERROR &&
+         miget_dimension_sizes(dims, n_dims, sizes) == MI_NOERROR &&
+         miget_dimension_starts(dims, MI_ORDER_FILE, n_dims, starts) == MI_NOERROR &&
+         miget_dimension_separations(dims, MI_ORDER_FILE, n_dims, steps) == MI_NOERROR);
+
+   /* geometry */
+   for(c = 0; ok && c < n_dims; c++){
+      if(miget_dimension_name(dims[c], &name) != MI_NOERROR){
+         ok = FALSE;
+         break;
+         }
+      cache_hash_string(hash, name);
+      mifree_name(name);
+
+      dircos[0] = dircos[1] = dircos[2] = 0.0;
+      miget_dimension_cosines(dims[c], dircos);
+
+      cache_hash_bytes(hash, &sizes[c], sizeof(misize_t));
+      cache_hash_bytes(hash, &starts[c], sizeof(double));
+      cache_hash_bytes(hash, &steps[c], sizeof(double));
+      cache_hash_bytes(hash, dircos, sizeof(dircos));
+      }
+
+   /* voxels, one slice of the slowest varying dimension at a time */
+   if(ok){
+      slice_len = 1;
+      for(c = 0; c < n_dims; c++){
+         start[c] = 0;
+         count[c] = sizes[c];
+         if(c > 0){
+            slice_len *= sizes[c];
+            }
+         }
+      count[0] = 1;
+
+      slice = (double *) malloc(slice_len * sizeof(double));
+      for(i = 0; ok && i < sizes[0]; i++){
+         start[0] = i;
+         ok = (miget_real_value_hyperslab(vol, MI_TYPE_DOUBLE, start, count, slice) == MI_NOERROR);
+         if(ok){
+            cache_hash_bytes(hash, slice, slice_len * sizeof(double));
+            }
+         }
+      free(slice);
+      }
+
+   miclose_volume(vol);
+   return ok;
+   }
+
+void cache_key_string(uint64_t hash, char key[CACHE_KEY_LEN]){
+   snprintf(key, CACHE_KEY_LEN, "%016llx", (unsigned long long)hash);
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : cache_fetch
+@INPUT      : dir - cache directory
+              key - cache key
+              outfiles - output file names indexed by kind (NULL if unused)
+              n_outfiles - number of kinds
+@RETURNS    : TRUE if every requested output was copied from the cache
+@DESCRIPTION: all entries are opened before anything is copied so that an
+              entry evicted by another process turns the whole lookup into
+              a miss (an open entry stays readable after it is unlinked).
+              Entries that are used are touched for the LRU eviction.
+ */
+int cache_fetch(const char *dir, const char *key, char *outfiles[], int n_outfiles){
+   char path[4096];
+   int *fds;
+   int c, out_fd, ok;
+
+   fds = (int *)malloc(n_outfiles * sizeof(int));
+   ok = TRUE;
+   for(c = 0; c < n_outfiles; c++){
+      fds[c] = -1;
+      if(ok && outfiles[c] != NULL){
+         entry_path(path, sizeof(path), dir, key, c);
+         fds[c] = open(path, O_RDONLY);
+         ok = (fds[c] >= 0);
+         }
+      }
+
+   for(c = 0; ok && c < n_outfiles; c++){
+      if(fds[c] >= 0){
+         out_fd = open(outfiles[c], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+         if(out_fd < 0 || !copy_fd(fds[c], out_fd)){
+            fprintf(stderr, "mincfft: could not copy cached result to %s\n", outfiles[c]);
+            ok = FALSE;
+            }
+         if(out_fd >= 0){
+            close(out_fd);
+            }
+
+         entry_path(path, sizeof(path), dir, key, c);
+         utime(path, NULL);
+         }
+      }
+
+   for(c = 0; c < n_outfiles; c++){
+      if(fds[c] >= 0){
+         close(fds[c]);
+         }
+      }
+   free(fds);
+
+   return ok;
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : cache_store
+@INPUT      : dir - cache directory (created if needed)
+              key - cache key
+              kind - output kind (OUTPUT_*)
+              fn - output file to store
+@RETURNS    : TRUE on success
+@DESCRIPTION: copies an output into the cache. Two writers of the same
+              entry write identical data, whichever rename lands last wins.
+ */
+int cache_store(const char *dir, const char *key, int kind, const char *fn){
+   char path[4096];
+   char tmp_path[4096];
+   int in_fd, tmp_fd, ok;
+
+   if(mkdir(dir, 0777) != 0 && errno != EEXIST){
+      fprintf(stderr, "mincfft: could not create cache directory %s: %s\n",
+              dir, strerror(errno));
+      return FALSE;
+      }
+
+   in_fd = open(fn, O_RDONLY);
+   if(in_fd < 0){
+      return FALSE;
+      }
+
+   snprintf(tmp_path, sizeof(tmp_path), "%s/.%s-%d.XXXXXX", dir, key, kind);
+   tmp_fd = mkstemp(tmp_path);
+   if(tmp_fd < 0){
+      fprintf(stderr, "mincfft: could not write to cache directory %s: %s\n",
+              dir, strerror(errno));
+      close(in_fd);
+      return FALSE;
+      }
+
+   ok = copy_fd(in_fd, tmp_fd);
+   ok &= (close(tmp_fd) == 0);
+   close(in_fd);
+
+   entry_path(path, sizeof(path), dir, key, kind);
+   if(!ok || rename(tmp_path, path) != 0){
+      unlink(tmp_path);
+      return FALSE;
+      }
+
+   return TRUE;
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : cache_evict
+@INPUT      : dir - cache directory
+              max_size - size limit (MB)
+@RETURNS    : nothing
+@DESCRIPTION: removes the least recently used entries until the cache is
+              within max_size. Another process may be evicting at the same
+              time, entries that have already gone are simply skipped. Only
+              files named as by cache_store are counted or removed, so the
+              cache can safely share a directory with other files.
+ */
+void cache_evict(const char *dir, double max_size){
+   DIR *d;
+   struct dirent *de;
+   struct stat st;
+   char path[4096];
+   cache_entry *entries;
+   int n_entries, max_entries, c, type;
+   double total, limit;
+   time_t now;
+
+   d = opendir(dir);
+   if(d == NULL){
+      return;
+      }
+
+   now = time(NULL);
+   limit = max_size * 1024.0 * 1024.0;
+   total = 0.0;
+   n_entries = 0;
+   max_entries = 256;
+   entries = (cache_entry *)malloc(max_entries * sizeof(cache_entry));
+
+   while((de = readdir(d)) != NULL){
+      type = cache_name_type(de->d_name);
+      if(type == CACHE_OTHER){
+         continue;
+         }
+
+      snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+      if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)){
+         continue;
+         }
+
+      /* temporary files, remove those left behind by dead writers */
+      if(type == CACHE_TMP){
+         if(now - st.st_mtime > CACHE_STALE_TMP){
+            unlink(path);
+            }
+         continue;
+         }
+
+      if(n_entries == max_entries){
+         max_entries *= 2;
+         entries = (cache_entry *)realloc(entries, max_entries * sizeof(cache_entry));
+         }
+      entries[n_entries].name = strdup(de->d_name);
+      entries[n_entries].size = st.st_size;
+      entries[n_entries].mtime = st.st_mtime;
+      total += (double)st.st_size;
+      n_entries++;
+      }
+   closedir(d);
+
+   /* oldest first */
+   qsort(entries, n_entries, sizeof(cache_entry), cmp_entry_age);
+   for(c = 0; c < n_entries; c++){
+      if(total > limit){
+         snprintf(path, sizeof(path), "%s/%s", dir, entries[c].name);
+         if(unlink(path) == 0 || errno == ENOENT){
+            total -= (double)entries[c].size;
+            }
+         }
+      free(entries[c].name);
+      }
+   free(entries);
+   }
+
+static void entry_path(char *path, size_t len, const char *dir, const char *key, int kind){
+   snprintf(path, len, "%s/%s-%d.mnc", dir, key, kind);
+   }
+
+static int copy_fd(int in_fd, int out_fd){
+   char buf[65536];
+   ssize_t n, w, done;
+
+   while((n = read(in_fd, buf, sizeof(buf))) > 0){
+      for(done = 0; done < n; done += w){
+         w = write(out_fd, buf + done, n - done);
+         if(w < 0){
+            if(errno == EINTR){
+               w = 0;
+               continue;
+               }
+            return FALSE;
+            }
+         }
+      }
+
+   return (n == 0);
+   }
+
+static int cmp_entry_age(const void *a, const void *b){
+   const cache_entry *ea = (const cache_entry *)a;
+   const cache_entry *eb = (const cache_entry *)b;
+
+   if(ea->mtime < eb->mtime){
+      return -1;
+      }
+   return (ea->mtime > eb->mtime);
+   }
+
+/* is a file name one of ours (an entry or a temporary file) */
+static int cache_name_type(const char *name){
+   int type, c;
+
+   type = CACHE_ENTRY;
+   if(*name == '.'){
+      type = CACHE_TMP;
+      name++;
+      }
+
+   /* key */
+   for(c = 0; c < CACHE_KEY_LEN - 1; c++){
+      if(!isdigit((unsigned char)name[c]) && (name[c] < 'a' || name[c] > 'f')){
+         return CACHE_OTHER;
+         }
+      }
+   name += CACHE_KEY_LEN - 1;
+
+   /* kind */
+   if(*name++ != '-' || !isdigit((unsigned char)*name)){
+      return CACHE_OTHER;
+      }
+   while(isdigit((unsigned char)*name)){
+      name++;
+      }
+
+   if(type == CACHE_ENTRY){
+      return (strcmp(name, ".mnc") == 0) ? CACHE_ENTRY : CACHE_OTHER;
+      }
+
+   /* mkstemp suffix */
+   if(*name++ != '.'){
+      return CACHE_OTHER;
+      }
+   for(c = 0; c < 6; c++){
+      if(!isalnum((unsigned char)name[c])){
+         return CACHE_OTHER;
+         }
+      }
+   return (name[6] == '\0') ? CACHE_TMP : CACHE_OTHER;
+   }
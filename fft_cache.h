@@ -0,0 +1,30 @@
+/* fft_cache.h */
+
+#ifndef FFT_CACHE_H
+#define FFT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* length of a cache key as hex (64 bit hash) plus the terminator */
+#define   CACHE_KEY_LEN          17
+
+/* default size limit of a cache directory (MB) */
+#define   CACHE_DEFAULT_SIZE     4096.0
+
+/* temporary files older than this (seconds) are left from a dead writer */
+#define   CACHE_STALE_TMP        3600
+
+void cache_hash_init(uint64_t *hash);
+void cache_hash_bytes(uint64_t *hash, const void *buf, size_t len);
+void cache_hash_string(uint64_t *hash, const char *str);
+int cache_hash_volume(uint64_t *hash, const char *fn);
+void cache_key_string(uint64_t hash, char key[CACHE_KEY_LEN]);
+
+int cache_fetch(const char *dir, const char *key, char *outfiles[], int n_outfiles);
+int cache_store(const char *dir, const char *key, int kind, const char *fn);
+void cache_evict(const char *dir, double max_size);
+
+
+#endif
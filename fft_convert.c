@@ -0,0 +1,142 @@
+/* fft_convert.c */
+/* type specialised conversion of volume rows to and from real (double) data, */
+/* used instead of the per voxel GET_VALUE and SET_VOXEL macros               */
+
+#include "fft_convert.h"
+
+/* one kernel per storage type, simple enough for the compiler to vectorise */
+#define DEFINE_ROW_FUNC(name, type) \
+   static void name(const void *src, double *dst, int n, double scale, double offset){ \
+      const type *s = (const type *) src; \
+      int c; \
+      for(c = 0; c < n; c++){ \
+         dst[c] = offset + scale * (double) s[c]; \
+         } \
+      }
+
+DEFINE_ROW_FUNC(row_from_ubyte, unsigned char)
+DEFINE_ROW_FUNC(row_from_sbyte, signed char)
+DEFINE_ROW_FUNC(row_from_ushort, unsigned short)
+DEFINE_ROW_FUNC(row_from_sshort, signed short)
+DEFINE_ROW_FUNC(row_from_uint, unsigned int)
+DEFINE_ROW_FUNC(row_from_sint, signed int)
+DEFINE_ROW_FUNC(row_from_float, float)
+DEFINE_ROW_FUNC(row_from_double, double)
+
+/* pick the kernel and voxel to real scaling for a volume */
+void init_voxel_converter(voxel_converter *conv, VIO_Volume vol){
+   int      c, n_dims;
+   int      sizes[VIO_MAX_DIMENSIONS];
+
+   n_dims = get_volume_n_dimensions(vol);
+   get_volume_sizes(vol, sizes);
+   conv->row_length = 1;
+   for(c = 2; c < n_dims; c++){
+      conv->row_length *= sizes[c];
+      }
+
+   /* real = offset + scale * voxel, as convert_voxel_to_value */
+   conv->offset = convert_voxel_to_value(vol, 0.0);
+   conv->scale = convert_voxel_to_value(vol, 1.0) - conv->offset;
+
+   /* cached volumes are not in memory, leave them to libminc */
+   conv->func = NULL;
+   if(vol->is_cached_volume){
+      return;
+      }
+
+   switch (get_volume_data_type(vol)){
+   case UNSIGNED_BYTE:
+      conv->func = row_from_ubyte;
+      break;
+
+   case SIGNED_BYTE:
+      conv->func = row_from_sbyte;
+      break;
+
+   case UNSIGNED_SHORT:
+      conv->func = row_from_ushort;
+      break;
+
+   case SIGNED_SHORT:
+      conv->func = row_from_sshort;
+      break;
+
+   case UNSIGNED_INT:
+      conv->func = row_from_uint;
+      break;
+
+   case SIGNED_INT:
+      conv->func = row_from_sint;
+      break;
+
+   case FLOAT:
+      conv->func = row_from_float;
+      break;
+
+   case DOUBLE:
+      conv->func = row_from_double;
+      break;
+
+   default:
+      break;
+      }
+   }
+
+/* real values of row (i, j) of a 3 or 4D volume, vector components interleaved */
+void get_volume_row(voxel_converter *conv, VIO_Volume vol, int i, int j, double *dst){
+   int      k, l;
+   int      sizes[VIO_MAX_DIMENSIONS];
+   void    *ptr;
+
+   if(conv->func != NULL){
+      if(get_volume_n_dimensions(vol) == 4){
+         GET_VOXEL_PTR_4D(ptr, vol, i, j, 0, 0);
+         }
+      else{
+         GET_VOXEL_PTR_3D(ptr, vol, i, j, 0);
+         }
+      conv->func(ptr, dst, conv->row_length, conv->scale, conv->offset);
+      return;
+      }
+
+   sizes[3] = 1;
+   get_volume_sizes(vol, sizes);
+   for(k = 0; k < sizes[2]; k++){
+      for(l = 0; l < conv->row_length / sizes[2]; l++){
+         *dst++ = get_volume_real_value(vol, i, j, k, l, 0);
+         }
+      }
+   }
+
+/* store row (i, j) of an NC_FLOAT working volume (as from prep_volume) */
+void set_volume_row(VIO_Volume vol, int i, int j, double *src, double divisor){
+   int      c, k, l;
+   int      n_dims, n_vec;
+   int      sizes[VIO_MAX_DIMENSIONS];
+   float   *ptr;
+
+   n_dims = get_volume_n_dimensions(vol);
+   sizes[3] = 1;
+   get_volume_sizes(vol, sizes);
+   n_vec = (n_dims == 4) ? sizes[3] : 1;
+
+   if(!vol->is_cached_volume && get_volume_data_type(vol) == FLOAT){
+      if(n_dims == 4){
+         GET_VOXEL_PTR_4D(ptr, vol, i, j, 0, 0);
+         }
+      else{
+         GET_VOXEL_PTR_3D(ptr, vol, i, j, 0);
+         }
+      for(c = 0; c < sizes[2] * n_vec; c++){
+         ptr[c] = (float) (src[c] / divisor);
+         }
+      return;
+      }
+
+   for(k = 0; k < sizes[2]; k++){
+      for(l = 0; l < n_vec; l++){
+         set_volume_real_value(vol, i, j, k, l, 0, *src++ / divisor);
+         }
+      }
+   }
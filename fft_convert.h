@@ -0,0 +1,26 @@
+/* fft_convert.h */
+
+#ifndef FFT_CONVERT_H
+#define FFT_CONVERT_H
+
+
+#include <minc2.h>
+#include <volume_io.h>
+
+/* convert n voxels of one storage type to reals: dst[c] = offset + scale * src[c] */
+typedef void (*voxel_row_func)(const void *src, double *dst, int n, double scale, double offset);
+
+/* picked once per volume and then used for every row */
+typedef struct {
+   voxel_row_func func;          /* NULL if we have to go through libminc */
+   double   scale;
+   double   offset;
+   int      row_length;          /* voxels per row, including any vector dimension */
+   } voxel_converter;
+
+void init_voxel_converter(voxel_converter *conv, VIO_Volume vol);
+void get_volume_row(voxel_converter *conv, VIO_Volume vol, int i, int j, double *dst);
+void set_volume_row(VIO_Volume vol, int i, int j, double *src, double divisor);
+
+
+#endif
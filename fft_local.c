@@ -0,0 +1,344 @@
+/* fft_local.c */
+/* local (patch-wise) 3D spectra reduced to texture features. Windowed    */
+/* patches are transformed in batches with a single many-transform plan,  */
+/* threads (OpenMP) each execute the plan on their own buffers and each   */
+/* spectrum is reduced to a handful of features as soon as it is made.    */
+
+#include <math.h>
+#include <string.h>
+#include <fftw3.h>
+#include "fft_support.h"
+#include "fft_local.h"
+#include "fft_convert.h"
+
+/* per frequency bin of the half (r2c) spectrum of a patch */
+typedef struct {
+   int      n_bins;
+   double  *weight;              /* 1 or 2, Hermitian partner not stored     */
+   double  *freq;                /* |f| (cycles/mm)                          */
+   double  *f;                   /* fz, fy, fx (cycles/mm)                   */
+   int     *band;                /* LOCAL_BAND_*, -1 for DC                  */
+   } spectrum_bins;
+
+/* function prototypes */
+static void init_spectrum_bins(spectrum_bins *bins, int window, VIO_Real separations[]);
+static void free_spectrum_bins(spectrum_bins *bins);
+static void extract_patch(double *vox, int sizes[], int origin[], int window,
+                          double *win3, double win_sum, double *patch);
+static void spectrum_features(fftw_complex *spec, spectrum_bins *bins, double *feat);
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : local_spectra_volume
+@INPUT      : in_vol - 3D (real) input volume
+              window - patch size (voxels, cubic)
+              stride - step between patches (voxels)
+              frequency_dimorder - dimension order for the output
+@OUTPUT     : out_vol - 4D feature volume, LOCAL_N_FEATURES long vector_dimension
+@RETURNS    : status variable - OK or ERROR.
+@DESCRIPTION: a patch is taken at every stride voxels, its (Hann) windowed
+              mean is removed and it is Hann windowed before the FFT. The
+              output has one voxel per patch, placed at the centre of the
+              patch. No complex data is kept past the feature reduction.
+ */
+VIO_Status local_spectra_volume(VIO_Volume in_vol, VIO_Volume *out_vol, int window, int stride,
+                                char *frequency_dimorder[]){
+   int      i, j, c;
+   int      sizes[3];
+   int      out_sizes[4];
+   int      n[3];
+   int      w3, n_patches, n_batches;
+   VIO_Real     starts[4];
+   VIO_Real     separations[4];
+   VIO_Real     tmp_dircos[3];
+   voxel_converter conv;
+   spectrum_bins bins;
+   double  *vox;
+   double  *win3;
+   double  *hann;
+   double  *feat;
+   double   win_sum;
+   double  *in;
+   fftw_complex *out;
+   fftw_plan p;
+
+   get_volume_sizes(in_vol, sizes);
+   get_volume_starts(in_vol, starts);
+   get_volume_separations(in_vol, separations);
+
+   if(window < 2 || stride < 1){
+      fprintf(stderr, "local_spectra_volume: window must be at least 2 and stride at least 1\n");
+      return (VIO_ERROR);
+      }
+   for(c = 0; c < 3; c++){
+      if(sizes[c] < window){
+         fprintf(stderr, "local_spectra_volume: window (%d) is larger than the volume (%d)\n",
+                 window, sizes[c]);
+         return (VIO_ERROR);
+         }
+      out_sizes[c] = (sizes[c] - window) / stride + 1;
+
+      /* output voxels sit at the centre of each patch */
+      starts[c] += separations[c] * (window - 1) / 2.0;
+      n[c] = window;
+      }
+   out_sizes[3] = LOCAL_N_FEATURES;
+   starts[3] = 0;
+   separations[3] = 1;
+
+   /* the input as doubles, a row at a time */
+   vox = (double *) malloc((size_t)sizes[0] * sizes[1] * sizes[2] * sizeof(double));
+   init_voxel_converter(&conv, in_vol);
+   for(i = 0; i < sizes[0]; i++){
+      for(j = 0; j < sizes[1]; j++){
+         get_volume_row(&conv, in_vol, i, j, &vox[((size_t)i * sizes[1] + j) * sizes[2]]);
+         }
+      }
+
+   /* separable Hann window */
+   w3 = window * window * window;
+   hann = (double *) malloc(window * sizeof(double));
+   win3 = (double *) malloc(w3 * sizeof(double));
+   for(c = 0; c < window; c++){
+      hann[c] = 0.5 - 0.5 * cos(2.0 * M_PI * (c + 0.5) / window);
+      }
+   win_sum = 0.0;
+   for(c = 0; c < w3; c++){
+      win3[c] = hann[c / (window * window)] * hann[(c / window) % window] * hann[c % window];
+      win_sum += win3[c];
+      }
+   free(hann);
+
+   init_spectrum_bins(&bins, window, separations);
+   for(c = 0; c < 3; c++){
+      separations[c] *= stride;
+      }
+
+   n_patches = out_sizes[0] * out_sizes[1] * out_sizes[2];
+   n_batches = (n_patches + LOCAL_BATCH - 1) / LOCAL_BATCH;
+   feat = (double *) malloc((size_t)n_patches * LOCAL_N_FEATURES * sizeof(double));
+
+   /* one plan for a batch of patches, executed on per-thread buffers */
+   in = (double *) fftw_malloc(sizeof(double) * LOCAL_BATCH * w3);
+   out = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * LOCAL_BATCH * bins.n_bins);
+   p = fftw_plan_many_dft_r2c(3, n, LOCAL_BATCH, in, NULL, 1, w3,
+                              out, NULL, 1, bins.n_bins, get_fft_planner_flags());
+   fftw_free(in);
+   fftw_free(out);
+
+#pragma omp parallel private(c)
+   {
+   int      b, patch, origin[3];
+   double  *t_in;
+   fftw_complex *t_out;
+
+   t_in = (double *) fftw_malloc(sizeof(double) * LOCAL_BATCH * w3);
+   t_out = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * LOCAL_BATCH * bins.n_bins);
+
+#pragma omp for schedule(dynamic)
+   for(b = 0; b < n_batches; b++){
+      for(c = 0; c < LOCAL_BATCH; c++){
+         patch = b * LOCAL_BATCH + c;
+         if(patch < n_patches){
+            origin[0] = (patch / (out_sizes[1] * out_sizes[2])) * stride;
+            origin[1] = ((patch / out_sizes[2]) % out_sizes[1]) * stride;
+            origin[2] = (patch % out_sizes[2]) * stride;
+            extract_patch(vox, sizes, origin, window, win3, win_sum, &t_in[c * w3]);
+            }
+         else{
+            memset(&t_in[c * w3], 0, w3 * sizeof(double));
+            }
+         }
+
+      fftw_execute_dft_r2c(p, t_in, t_out);
+
+      for(c = 0; c < LOCAL_BATCH; c++){
+         patch = b * LOCAL_BATCH + c;
+         if(patch < n_patches){
+            spectrum_features(&t_out[c * bins.n_bins], &bins,
+                              &feat[(size_t)patch * LOCAL_N_FEATURES]);
+            }
+         }
+      }
+
+   fftw_free(t_in);
+   fftw_free(t_out);
+   }
+
+   fftw_destroy_plan(p);
+   free_spectrum_bins(&bins);
+   free(win3);
+   free(vox);
+
+   /* define the feature volume */
+   *out_vol = create_volume(4, frequency_dimorder, NC_FLOAT, TRUE, 0.0, 0.0);
+   set_volume_sizes(*out_vol, out_sizes);
+   set_volume_starts(*out_vol, starts);
+   set_volume_separations(*out_vol, separations);
+   for(c = 0; c < 3; c++){
+      get_volume_direction_cosine(in_vol, c, tmp_dircos);
+      set_volume_direction_cosine(*out_vol, c, tmp_dircos);
+      }
+   alloc_volume_data(*out_vol);
+
+   for(i = 0; i < out_sizes[0]; i++){
+      for(j = 0; j < out_sizes[1]; j++){
+         set_volume_row(*out_vol, i, j,
+                        &feat[((size_t)i * out_sizes[1] + j) * out_sizes[2] * LOCAL_N_FEATURES],
+                        1.0);
+         }
+      }
+   free(feat);
+
+   calc_volume_range(*out_vol);
+
+   return (VIO_OK);
+   }
+
+/* frequency, band and weight of every bin of a window^3 r2c spectrum */
+static void init_spectrum_bins(spectrum_bins *bins, int window, VIO_Real separations[]){
+   int      a, b, c, idx, half;
+   int      k[3];
+   double   rho;
+
+   half = window / 2 + 1;
+   bins->n_bins = window * window * half;
+   bins->weight = (double *) malloc(bins->n_bins * sizeof(double));
+   bins->freq = (double *) malloc(bins->n_bins * sizeof(double));
+   bins->f = (double *) malloc(3 * bins->n_bins * sizeof(double));
+   bins->band = (int *) malloc(bins->n_bins * sizeof(int));
+
+   idx = 0;
+   for(a = 0; a < window; a++){
+      for(b = 0; b < window; b++){
+         for(c = 0; c < half; c++){
+            k[0] = (a <= window / 2) ? a : a - window;
+            k[1] = (b <= window / 2) ? b : b - window;
+            k[2] = c;
+
+            /* bins on the x = 0 and x = Nyquist planes have no stored partner */
+            bins->weight[idx] = (c == 0 || (window % 2 == 0 && c == window / 2)) ? 1.0 : 2.0;
+
+            bins->f[3 * idx + 0] = k[0] / (window * separations[0]);
+            bins->f[3 * idx + 1] = k[1] / (window * separations[1]);
+            bins->f[3 * idx + 2] = k[2] / (window * separations[2]);
+            bins->freq[idx] = sqrt(bins->f[3 * idx + 0] * bins->f[3 * idx + 0] +
+                                   bins->f[3 * idx + 1] * bins->f[3 * idx + 1] +
+                                   bins->f[3 * idx + 2] * bins->f[3 * idx + 2]);
+
+            /* radial frequency relative to Nyquist (cycles/voxel) */
+            rho = sqrt((double)(k[0] * k[0] + k[1] * k[1] + k[2] * k[2])) / (0.5 * window);
+            if(idx == 0){
+               bins->band[idx] = -1;
+               }
+            else if(rho < 0.25){
+               bins->band[idx] = LOCAL_BAND_LOW;
+               }
+            else if(rho < 0.5){
+               bins->band[idx] = LOCAL_BAND_MID;
+               }
+            else{
+               bins->band[idx] = LOCAL_BAND_HIGH;
+               }
+            idx++;
+            }
+         }
+      }
+   }
+
+static void free_spectrum_bins(spectrum_bins *bins){
+   free(bins->weight);
+   free(bins->freq);
+   free(bins->f);
+   free(bins->band);
+   }
+
+/* copy a patch, remove its windowed mean and apply the window */
+static void extract_patch(double *vox, int sizes[], int origin[], int window,
+                          double *win3, double win_sum, double *patch){
+   int      i, j, k, idx;
+   double  *src;
+   double   mean;
+
+   idx = 0;
+   mean = 0.0;
+   for(i = 0; i < window; i++){
+      for(j = 0; j < window; j++){
+         src = &vox[(((size_t)origin[0] + i) * sizes[1] + origin[1] + j) * sizes[2] + origin[2]];
+         for(k = 0; k < window; k++){
+            patch[idx] = src[k];
+            mean += win3[idx] * src[k];
+            idx++;
+            }
+         }
+      }
+   mean /= win_sum;
+
+   for(idx = window * window * window; idx--;){
+      patch[idx] = (patch[idx] - mean) * win3[idx];
+      }
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : spectrum_features
+@INPUT      : spec - half spectrum of one patch
+              bins - bin frequencies and weights
+@OUTPUT     : feat - LOCAL_N_FEATURES features
+@RETURNS    : nothing
+@DESCRIPTION: band energies are fractions of the total (non DC) power. The
+              anisotropy is that of the power weighted inertia tensor
+              T = sum P(f) f f', as for FA: 0 when the power is spread
+              evenly over all directions, 1 when it lies along one.
+ */
+static void spectrum_features(fftw_complex *spec, spectrum_bins *bins, double *feat){
+   int      c, max_bin;
+   double   power, total, max_power;
+   double   band[3];
+   double   t[6];                /* xx, yy, zz, xy, xz, yz */
+   double  *f;
+   double   tr, dev, norm;
+
+   total = 0.0;
+   max_power = 0.0;
+   max_bin = 0;
+   band[0] = band[1] = band[2] = 0.0;
+   t[0] = t[1] = t[2] = t[3] = t[4] = t[5] = 0.0;
+
+   for(c = 1; c < bins->n_bins; c++){
+      power = spec[c][0] * spec[c][0] + spec[c][1] * spec[c][1];
+      if(power > max_power){
+         max_power = power;
+         max_bin = c;
+         }
+
+      power *= bins->weight[c];
+      total += power;
+      band[bins->band[c] - LOCAL_BAND_LOW] += power;
+
+      f = &bins->f[3 * c];
+      t[0] += power * f[0] * f[0];
+      t[1] += power * f[1] * f[1];
+      t[2] += power * f[2] * f[2];
+      t[3] += power * f[0] * f[1];
+      t[4] += power * f[0] * f[2];
+      t[5] += power * f[1] * f[2];
+      }
+
+   for(c = 0; c < LOCAL_N_FEATURES; c++){
+      feat[c] = 0.0;
+      }
+   if(total <= 0.0){
+      return;
+      }
+
+   feat[LOCAL_DOMINANT_FREQ] = bins->freq[max_bin];
+   feat[LOCAL_BAND_LOW] = band[0] / total;
+   feat[LOCAL_BAND_MID] = band[1] / total;
+   feat[LOCAL_BAND_HIGH] = band[2] / total;
+
+   tr = (t[0] + t[1] + t[2]) / 3.0;
+   dev = (t[0] - tr) * (t[0] - tr) + (t[1] - tr) * (t[1] - tr) + (t[2] - tr) * (t[2] - tr) +
+         2.0 * (t[3] * t[3] + t[4] * t[4] + t[5] * t[5]);
+   norm = t[0] * t[0] + t[1] * t[1] + t[2] * t[2] +
+          2.0 * (t[3] * t[3] + t[4] * t[4] + t[5] * t[5]);
+   feat[LOCAL_ANISOTROPY] = (norm > 0.0) ? sqrt(1.5 * dev / norm) : 0.0;
+   }
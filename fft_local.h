@@ -0,0 +1,25 @@
+/* fft_local.h */
+
+#ifndef FFT_LOCAL_H
+#define FFT_LOCAL_H
+
+
+#include <minc2.h>
+#include <volume_io.h>
+
+/* features written (in order) along the vector_dimension of a local spectrum */
+#define   LOCAL_DOMINANT_FREQ    0   /* cycles/mm of the strongest (non DC) component */
+#define   LOCAL_BAND_LOW         1   /* fraction of power below 1/4 Nyquist           */
+#define   LOCAL_BAND_MID         2   /* fraction of power from 1/4 to 1/2 Nyquist     */
+#define   LOCAL_BAND_HIGH        3   /* fraction of power above 1/2 Nyquist           */
+#define   LOCAL_ANISOTROPY       4   /* anisotropy of the spectral inertia tensor     */
+#define   LOCAL_N_FEATURES       5
+
+/* number of patches transformed by each (many) FFTW plan execution */
+#define   LOCAL_BATCH            32
+
+VIO_Status local_spectra_volume(VIO_Volume in_vol, VIO_Volume *out_vol, int window, int stride,
+                                char *frequency_dimorder[]);
+
+
+#endif
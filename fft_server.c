@@ -0,0 +1,649 @@
+/* fft_server.c */
+/* resident mincfft server, jobs arrive over a local (unix) socket and are */
+/* run in forked children that share the server's accumulated FFTW wisdom  */
+
+#define _GNU_SOURCE               /* struct ucred for SO_PEERCRED */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include <fftw3.h>
+#include <ParseArgv.h>
+#include "fft_server.h"
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+#define JOB_STARTING   0         /* forked, waiting for its memory estimate */
+#define JOB_WAITING    1         /* estimate known, waiting for a free slot */
+#define JOB_RUNNING    2
+
+typedef struct {
+   pid_t    pid;
+   int      conn;                /* client connection (status trailer)       */
+   int      msg_fd;              /* messages from the job (estimate, wisdom) */
+   int      go_fd;               /* start ('Y') or refuse ('N') the job      */
+   int      state;
+   long     memory;              /* estimated memory use (bytes)             */
+   struct timeval start;
+   } server_job;
+
+typedef struct {
+   int      conn;                /* client connection, request not yet whole */
+   int      out_fd;              /* the client's stdout and stderr, passed   */
+   int      err_fd;              /* with the request (-1 until they arrive)  */
+   int      len;                 /* bytes of the request read so far         */
+   char    *buf;
+   time_t   since;               /* when the connection was accepted         */
+   } server_request;
+
+/* function prototypes */
+static void stop_server(int sig);
+static int peer_is_us(int conn);
+static int write_all(int fd, const void *buf, size_t len);
+static int read_all(int fd, void *buf, size_t len);
+static int read_request(server_request *req, char **cwd, int *argc, char *argv[], int max_args);
+static int send_job_message(int fd, char type, long value, const char *payload);
+static int read_job_message(server_job *job);
+static void drop_request(server_request *req);
+static void start_job(server_job *job, server_request *req, char *cwd, int argc, char *argv[],
+                      job_main_func job_main, job_memory_func job_memory);
+static void finish_job(server_job *job, int wstatus);
+
+static int max_jobs = 1;
+static double max_memory = 0.0;
+static char *wisdom_file = NULL;
+
+static volatile sig_atomic_t stop_flag = FALSE;
+static int listen_fd = -1;
+static server_job jobs[SERVER_MAX_QUEUE];
+static int n_jobs = 0;
+static server_request pending[SERVER_MAX_QUEUE];
+static int n_pending = 0;
+
+static ArgvInfo serverArgTable[] = {
+   {NULL, ARGV_HELP, NULL, NULL, "\nServer options"},
+   {"-max_jobs", ARGV_INT, (char *)1, (char *)&max_jobs,
+    "<n> Maximum number of jobs to run at once."},
+   {"-max_memory", ARGV_FLOAT, (char *)1, (char *)&max_memory,
+    "<MB> Memory budget shared by running jobs (0 for no limit)."},
+   {"-wisdom", ARGV_STRING, (char *)1, (char *)&wisdom_file,
+    "<file> Load FFTW wisdom on startup and save it on shutdown."},
+
+   {NULL, ARGV_HELP, NULL, NULL, ""},
+   {NULL, ARGV_END, NULL, NULL, NULL}
+   };
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : serve_jobs
+@INPUT      : socket_path - unix socket to listen on
+              argc, argv - server options (argv[0] is ignored)
+              job_main - runs a job, as main()
+              job_memory - estimates the memory (bytes) a job will need
+@RETURNS    : EXIT_SUCCESS or EXIT_FAILURE
+@DESCRIPTION: jobs are forked from the server so startup and argument
+              parsing are paid once and every job plans against the
+              wisdom gathered by the jobs before it. At most max_jobs run
+              at once and the sum of their estimates stays within
+              max_memory, other jobs are queued in order of arrival.
+ */
+int serve_jobs(char *socket_path, int argc, char *argv[],
+               job_main_func job_main, job_memory_func job_memory){
+   int      c, conn, max_fd;
+   int      n_running, job_argc, wstatus;
+   mode_t   old_umask;
+   long     used_memory, budget;
+   char    *job_argv[SERVER_MAX_REQUEST / 2];
+   char    *job_cwd;
+   pid_t    pid;
+   time_t   now;
+   server_request req;
+   fd_set   fds;
+   struct timeval timeout;
+   struct sockaddr_un addr;
+   struct stat st;
+
+   if(ParseArgv(&argc, argv, serverArgTable, 0) || (argc != 1) || max_jobs < 1){
+      fprintf(stderr, "\nUsage: mincfft --serve <socket> [<server options>]\n\n");
+      return (EXIT_FAILURE);
+      }
+   budget = (long)(max_memory * 1024.0 * 1024.0);
+
+   if(strlen(socket_path) >= sizeof(addr.sun_path)){
+      fprintf(stderr, "mincfft: socket path %s is too long\n", socket_path);
+      return (EXIT_FAILURE);
+      }
+
+   if(wisdom_file != NULL && access(wisdom_file, R_OK) == 0){
+      if(!fftw_import_wisdom_from_filename(wisdom_file)){
+         fprintf(stderr, "mincfft: could not read wisdom from %s\n", wisdom_file);
+         }
+      }
+
+   /* a stale socket from a previous server is removed, anything else is not */
+   if(stat(socket_path, &st) == 0){
+      if(!S_ISSOCK(st.st_mode)){
+         fprintf(stderr, "mincfft: %s exists and is not a socket\n", socket_path);
+         return (EXIT_FAILURE);
+         }
+      unlink(socket_path);
+      }
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, socket_path);
+
+   /* jobs run as us, so only we may connect (the socket is created 0600) */
+   old_umask = umask(077);
+   listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if(listen_fd < 0 ||
+      bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listen_fd, SERVER_MAX_QUEUE) != 0){
+      fprintf(stderr, "mincfft: could not listen on %s: %s\n", socket_path, strerror(errno));
+      umask(old_umask);
+      return (EXIT_FAILURE);
+      }
+   umask(old_umask);
+   chmod(socket_path, S_IRUSR | S_IWUSR);
+
+   signal(SIGPIPE, SIG_IGN);
+   signal(SIGINT, stop_server);
+   signal(SIGTERM, stop_server);
+
+   fprintf(stdout, "mincfft: serving on %s (max %d jobs", socket_path, max_jobs);
+   if(budget > 0){
+      fprintf(stdout, ", %g MB", max_memory);
+      }
+   fprintf(stdout, ")\n");
+   fflush(stdout);
+
+   while(!stop_flag){
+
+      /* collect finished jobs */
+      while((pid = waitpid(-1, &wstatus, WNOHANG)) > 0){
+         for(c = 0; c < n_jobs; c++){
+            if(jobs[c].pid == pid){
+               finish_job(&jobs[c], wstatus);
+               n_jobs--;
+               memmove(&jobs[c], &jobs[c + 1], (n_jobs - c) * sizeof(server_job));
+               break;
+               }
+            }
+         }
+
+      /* start queued jobs in order of arrival while there is room */
+      n_running = 0;
+      used_memory = 0;
+      for(c = 0; c < n_jobs; c++){
+         if(jobs[c].state == JOB_RUNNING){
+            n_running++;
+            used_memory += jobs[c].memory;
+            }
+         }
+      for(c = 0; c < n_jobs && n_running < max_jobs; c++){
+         if(jobs[c].state != JOB_WAITING){
+            continue;
+            }
+
+         /* a job that can never fit is refused rather than queued forever */
+         if(budget > 0 && jobs[c].memory > budget){
+            write_all(jobs[c].go_fd, "N", 1);
+            jobs[c].memory = 0;
+            jobs[c].state = JOB_RUNNING;
+            continue;
+            }
+         if(budget > 0 && used_memory + jobs[c].memory > budget){
+            break;
+            }
+
+         write_all(jobs[c].go_fd, "Y", 1);
+         jobs[c].state = JOB_RUNNING;
+         n_running++;
+         used_memory += jobs[c].memory;
+         }
+
+      /* drop clients that never finish sending their request */
+      now = time(NULL);
+      for(c = 0; c < n_pending; ){
+         if(now - pending[c].since > SERVER_REQUEST_TIMEOUT){
+            drop_request(&pending[c]);
+            n_pending--;
+            memmove(&pending[c], &pending[c + 1], (n_pending - c) * sizeof(server_request));
+            }
+         else{
+            c++;
+            }
+         }
+
+      /* wait for a new connection, more of a request or a message from a job */
+      FD_ZERO(&fds);
+      max_fd = -1;
+      if(n_jobs + n_pending < SERVER_MAX_QUEUE){
+         FD_SET(listen_fd, &fds);
+         max_fd = listen_fd;
+         }
+      for(c = 0; c < n_pending; c++){
+         FD_SET(pending[c].conn, &fds);
+         if(pending[c].conn > max_fd){
+            max_fd = pending[c].conn;
+            }
+         }
+      for(c = 0; c < n_jobs; c++){
+         if(jobs[c].msg_fd != -1){
+            FD_SET(jobs[c].msg_fd, &fds);
+            if(jobs[c].msg_fd > max_fd){
+               max_fd = jobs[c].msg_fd;
+               }
+            }
+         }
+      timeout.tv_sec = 0;
+      timeout.tv_usec = 100000;
+      if(select(max_fd + 1, &fds, NULL, NULL, &timeout) <= 0){
+         continue;
+         }
+
+      for(c = 0; c < n_jobs; c++){
+         if(jobs[c].msg_fd != -1 && FD_ISSET(jobs[c].msg_fd, &fds)){
+            read_job_message(&jobs[c]);
+            }
+         }
+
+      /* requests are read as they arrive so a slow client holds up nobody */
+      for(c = 0; c < n_pending; ){
+         if(!FD_ISSET(pending[c].conn, &fds)){
+            c++;
+            continue;
+            }
+         switch (read_request(&pending[c], &job_cwd, &job_argc, job_argv,
+                              SERVER_MAX_REQUEST / 2)){
+         case 0:
+            c++;
+            break;
+
+         case 1:
+            req = pending[c];
+            n_pending--;
+            memmove(&pending[c], &pending[c + 1], (n_pending - c) * sizeof(server_request));
+            start_job(&jobs[n_jobs], &req, job_cwd, job_argc, job_argv,
+                      job_main, job_memory);
+            if(jobs[n_jobs].pid > 0){
+               n_jobs++;
+               }
+            break;
+
+         default:
+            drop_request(&pending[c]);
+            n_pending--;
+            memmove(&pending[c], &pending[c + 1], (n_pending - c) * sizeof(server_request));
+            break;
+            }
+         }
+
+      if(FD_ISSET(listen_fd, &fds)){
+         conn = accept(listen_fd, NULL, NULL);
+         if(conn < 0){
+            continue;
+            }
+         if(!peer_is_us(conn)){
+            close(conn);
+            continue;
+            }
+         pending[n_pending].buf = (char *) malloc(SERVER_MAX_REQUEST);
+         if(pending[n_pending].buf == NULL){
+            close(conn);
+            continue;
+            }
+         pending[n_pending].conn = conn;
+         pending[n_pending].out_fd = -1;
+         pending[n_pending].err_fd = -1;
+         pending[n_pending].len = 0;
+         pending[n_pending].since = time(NULL);
+         n_pending++;
+         }
+      }
+
+   /* be tidy */
+   close(listen_fd);
+   unlink(socket_path);
+   for(c = 0; c < n_pending; c++){
+      drop_request(&pending[c]);
+      }
+   for(c = 0; c < n_jobs; c++){
+      kill(jobs[c].pid, SIGTERM);
+      }
+   if(wisdom_file != NULL){
+      fftw_export_wisdom_to_filename(wisdom_file);
+      }
+
+   return (EXIT_SUCCESS);
+   }
+
+/* is the other end of a connection run by our user */
+static int peer_is_us(int conn){
+#ifdef SO_PEERCRED
+   struct ucred cred;
+   socklen_t len;
+
+   len = sizeof(cred);
+   if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != getuid()){
+      return FALSE;
+      }
+#endif
+   return TRUE;
+   }
+
+static void stop_server(int sig){
+   stop_flag = TRUE;
+   }
+
+static int write_all(int fd, const void *buf, size_t len){
+   const char *ptr = (const char *) buf;
+   ssize_t n;
+
+   while(len > 0){
+      n = write(fd, ptr, len);
+      if(n < 0 && errno == EINTR){
+         continue;
+         }
+      if(n <= 0){
+         return FALSE;
+         }
+      ptr += n;
+      len -= n;
+      }
+   return TRUE;
+   }
+
+static int read_all(int fd, void *buf, size_t len){
+   char *ptr = (char *) buf;
+   ssize_t n;
+
+   while(len > 0){
+      n = read(fd, ptr, len);
+      if(n < 0 && errno == EINTR){
+         continue;
+         }
+      if(n <= 0){
+         return FALSE;
+         }
+      ptr += n;
+      len -= n;
+      }
+   return TRUE;
+   }
+
+/* read what has arrived of a request (cwd, args and an empty string, all */
+/* NUL terminated, the client's stdout and stderr ride along with the     */
+/* first bytes), returns 1 once it is whole, 0 for more and -1 if bad     */
+static int read_request(server_request *req, char **cwd, int *argc, char *argv[], int max_args){
+   int      start, c;
+   int      fds[2];
+   ssize_t  n;
+   struct msghdr msg;
+   struct iovec iov;
+   struct cmsghdr *cmsg;
+   union {
+      char     buf[CMSG_SPACE(sizeof(fds))];
+      struct cmsghdr align;
+      } control;
+
+   iov.iov_base = req->buf + req->len;
+   iov.iov_len = SERVER_MAX_REQUEST - req->len;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control.buf;
+   msg.msg_controllen = sizeof(control.buf);
+
+   n = recvmsg(req->conn, &msg, MSG_DONTWAIT);
+   if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+      return 0;
+      }
+   if(n <= 0){
+      return -1;
+      }
+   req->len += n;
+
+   for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+      if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS){
+         continue;
+         }
+      if(cmsg->cmsg_len != CMSG_LEN(sizeof(fds))){
+         return -1;
+         }
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+      if(req->out_fd != -1){
+         close(fds[0]);
+         close(fds[1]);
+         return -1;
+         }
+      req->out_fd = fds[0];
+      req->err_fd = fds[1];
+      }
+   if(msg.msg_flags & MSG_CTRUNC){
+      return -1;
+      }
+
+   *argc = 0;
+   *cwd = NULL;
+   start = 0;
+   for(c = 0; c < req->len; c++){
+      if(req->buf[c] != '\0'){
+         continue;
+         }
+
+      /* an empty string ends the request */
+      if(c == start){
+         argv[*argc] = NULL;
+         return (*cwd != NULL && *argc > 0 && req->out_fd != -1) ? 1 : -1;
+         }
+      if(*cwd == NULL){
+         *cwd = &req->buf[start];
+         }
+      else if(*argc < max_args - 1){
+         argv[(*argc)++] = &req->buf[start];
+         }
+      start = c + 1;
+      }
+
+   return (req->len < SERVER_MAX_REQUEST) ? 0 : -1;
+   }
+
+/* close a request's connection and any descriptors it passed us */
+static void drop_request(server_request *req){
+   close(req->conn);
+   if(req->out_fd != -1){
+      close(req->out_fd);
+      close(req->err_fd);
+      }
+   free(req->buf);
+   }
+
+static int send_job_message(int fd, char type, long value, const char *payload){
+   return (write_all(fd, &type, 1) &&
+           write_all(fd, &value, sizeof(value)) &&
+           (payload == NULL || write_all(fd, payload, value)));
+   }
+
+/* read one message from a job, returns FALSE once the job closes its end */
+static int read_job_message(server_job *job){
+   char     type;
+   long     value;
+   char    *wisdom;
+
+   if(!read_all(job->msg_fd, &type, 1) || !read_all(job->msg_fd, &value, sizeof(value))){
+      close(job->msg_fd);
+      job->msg_fd = -1;
+      return FALSE;
+      }
+
+   switch (type){
+   case 'E':
+      job->memory = value;
+      if(job->state == JOB_STARTING){
+         job->state = JOB_WAITING;
+         }
+      break;
+
+   case 'W':
+      wisdom = (char *) malloc(value + 1);
+      if(read_all(job->msg_fd, wisdom, value)){
+         wisdom[value] = '\0';
+         fftw_import_wisdom_from_string(wisdom);
+         }
+      free(wisdom);
+      break;
+
+   default:
+      break;
+      }
+
+   return TRUE;
+   }
+
+/* fork a job, it reports its memory estimate and waits to be started, */
+/* the request is consumed (its connection is kept for the trailer)    */
+static void start_job(server_job *job, server_request *req, char *cwd, int argc, char *argv[],
+                      job_main_func job_main, job_memory_func job_memory){
+   int      c, status;
+   int      msg_pipe[2];
+   int      go_pipe[2];
+   long     memory;
+   char     go;
+   char    *wisdom;
+
+   job->pid = -1;
+   if(pipe(msg_pipe) != 0){
+      drop_request(req);
+      return;
+      }
+   if(pipe(go_pipe) != 0){
+      close(msg_pipe[0]);
+      close(msg_pipe[1]);
+      drop_request(req);
+      return;
+      }
+
+   job->pid = fork();
+   if(job->pid == 0){
+
+      /* the job: drop the server's descriptors and write to the client's */
+      signal(SIGPIPE, SIG_DFL);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      close(listen_fd);
+      for(c = 0; c < n_pending; c++){
+         close(pending[c].conn);
+         if(pending[c].out_fd != -1){
+            close(pending[c].out_fd);
+            close(pending[c].err_fd);
+            }
+         }
+      for(c = 0; c < n_jobs; c++){
+         close(jobs[c].conn);
+         close(jobs[c].go_fd);
+         if(jobs[c].msg_fd != -1){
+            close(jobs[c].msg_fd);
+            }
+         }
+      close(msg_pipe[0]);
+      close(go_pipe[1]);
+
+      close(req->conn);
+      dup2(req->out_fd, STDOUT_FILENO);
+      dup2(req->err_fd, STDERR_FILENO);
+      close(req->out_fd);
+      close(req->err_fd);
+
+      if(chdir(cwd) != 0){
+         fprintf(stderr, "mincfft: cannot change to %s: %s\n", cwd, strerror(errno));
+         exit(EXIT_FAILURE);
+         }
+
+      memory = job_memory(argc, argv);
+      send_job_message(msg_pipe[1], 'E', memory, NULL);
+      if(!read_all(go_pipe[0], &go, 1)){
+         exit(EXIT_FAILURE);
+         }
+      if(go != 'Y'){
+         fprintf(stderr, "mincfft: job needs %.1f MB but the server budget is %g MB\n",
+                 memory / (1024.0 * 1024.0), max_memory);
+         exit(EXIT_FAILURE);
+         }
+
+      status = job_main(argc, argv);
+      fflush(stdout);
+      fflush(stderr);
+
+      /* hand what we learnt about planning back to the server */
+      wisdom = fftw_export_wisdom_to_string();
+      if(wisdom != NULL){
+         send_job_message(msg_pipe[1], 'W', (long) strlen(wisdom), wisdom);
+         free(wisdom);
+         }
+
+      exit((status == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+      }
+
+   close(msg_pipe[1]);
+   close(go_pipe[0]);
+   if(job->pid < 0){
+      close(msg_pipe[0]);
+      close(go_pipe[1]);
+      drop_request(req);
+      return;
+      }
+
+   /* only the job writes to the client's stdout and stderr */
+   close(req->out_fd);
+   close(req->err_fd);
+   free(req->buf);
+
+   job->conn = req->conn;
+   job->msg_fd = msg_pipe[0];
+   job->go_fd = go_pipe[1];
+   job->state = JOB_STARTING;
+   job->memory = 0;
+   gettimeofday(&job->start, NULL);
+   }
+
+/* send the status and timing of a finished job to its client */
+static void finish_job(server_job *job, int wstatus){
+   int      code;
+   char     trailer[128];
+   struct timeval end;
+
+   /* pick up any wisdom the job left behind */
+   while(job->msg_fd != -1){
+      read_job_message(job);
+      }
+
+   gettimeofday(&end, NULL);
+   if(WIFEXITED(wstatus)){
+      code = WEXITSTATUS(wstatus);
+      }
+   else{
+      code = 128 + WTERMSIG(wstatus);
+      }
+
+   trailer[0] = SERVER_STATUS_MARKER;
+   sprintf(&trailer[1], "status %d %.3f\n", code,
+           (end.tv_sec - job->start.tv_sec) + (end.tv_usec - job->start.tv_usec) / 1e6);
+   write_all(job->conn, trailer, 1 + strlen(&trailer[1]));
+
+   close(job->conn);
+   close(job->go_fd);
+   }
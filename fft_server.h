@@ -0,0 +1,33 @@
+/* fft_server.h */
+
+#ifndef FFT_SERVER_H
+#define FFT_SERVER_H
+
+
+/* environment variable naming the socket used by mincfft_client */
+#define   SERVER_SOCKET_ENV      "MINCFFT_SOCKET"
+
+/* largest job request (cwd and arguments, NUL separated) */
+#define   SERVER_MAX_REQUEST     65536
+
+/* most jobs (running or queued) the server will hold at once */
+#define   SERVER_MAX_QUEUE       64
+
+/* seconds a client may take to send its whole request */
+#define   SERVER_REQUEST_TIMEOUT 30
+
+/* A request is the client's working directory followed by the job's      */
+/* arguments, each NUL terminated, and then an empty string. The client's */
+/* stdout and stderr are passed (SCM_RIGHTS) with its first bytes and the */
+/* job writes to them directly. The reply on the connection is only a NUL */
+/* followed by "status <code> <seconds>\n"                                 */
+#define   SERVER_STATUS_MARKER   '\0'
+
+typedef int (*job_main_func)(int argc, char *argv[]);
+typedef long (*job_memory_func)(int argc, char *argv[]);
+
+int serve_jobs(char *socket_path, int argc, char *argv[],
+               job_main_func job_main, job_memory_func job_memory);
+
+
+#endif
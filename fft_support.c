@@ -5,22 +5,37 @@
 #include <float.h>
 #include <fftw3.h>
 #include "fft_support.h"
+#include "fft_convert.h"
 
 /* definitions to support fftw2 complex data type operations in fftw3 */
 #define c_re(c) ((c)[0])
 #define c_im(c) ((c)[1])
 
+/* planner flags for the whole volume transforms, see set_fft_planner_measure */
+static unsigned fft_planner = FFTW_ESTIMATE;
+
 /* function prototypes */
 VIO_Status fft_volume_1d(VIO_Volume data, int inverse_flg, int centre);
 VIO_Status fft_volume_2d(VIO_Volume data, int inverse_flg, int centre);
 VIO_Status fft_volume_3d(VIO_Volume data, int inverse_flg, int centre);
 
+/* measure (rather than estimate) plans, worth it when the wisdom is kept */
+void set_fft_planner_measure(int measure){
+   fft_planner = (measure) ? FFTW_MEASURE : FFTW_ESTIMATE;
+   }
+
+unsigned get_fft_planner_flags(void){
+   return fft_planner;
+   }
+
 /* prepare a volume for FFT */
 VIO_Status prep_volume(VIO_Volume *in_vol, VIO_Volume *out_vol, char *frequency_dimorder[]){
    int      i, j, k;
-   VIO_Real     value;
    VIO_progress_struct progress;
    VIO_Real     min, max;
+   voxel_converter conv;
+   double  *row;
+   double  *complex_row;
 
    int      sizes[4];
    VIO_Real     starts[4];
@@ -53,28 +68,135 @@ VIO_Status prep_volume(VIO_Volume *in_vol, VIO_Volume *out_vol, char *frequency_
    /* allocate space for out_vol */
    alloc_volume_data(*out_vol);
 
-   initialize_progress_report(&progress, FALSE, sizes[0], "Prep VIO_Volume");
-   for(i = sizes[0]; i--;){
-      for(j = sizes[1]; j--;){
-         for(k = sizes[2]; k--;){
+   /* convert a row at a time with a kernel for the input's storage type */
+   init_voxel_converter(&conv, *in_vol);
+   row = (double *) malloc(sizes[2] * sizeof(double));
+   complex_row = (double *) malloc(sizes[2] * 2 * sizeof(double));
 
-            GET_VALUE_3D(value, *in_vol, i, j, k);
-            set_volume_real_value(*out_vol, i, j, k, 0, 0, value);   /* real */
-            set_volume_real_value(*out_vol, i, j, k, 1, 0, 0.0);  /* imag */
+   initialize_progress_report(&progress, FALSE, sizes[0], "Prep VIO_Volume");
+   for(i = 0; i < sizes[0]; i++){
+      for(j = 0; j < sizes[1]; j++){
+         get_volume_row(&conv, *in_vol, i, j, row);
+         for(k = 0; k < sizes[2]; k++){
+            complex_row[2 * k] = row[k];        /* real */
+            complex_row[2 * k + 1] = 0.0;       /* imag */
             }
+         set_volume_row(*out_vol, i, j, complex_row, 1.0);
          }
+      update_progress_report(&progress, i + 1);
       }
 
    /* be tidy */
+   free(row);
+   free(complex_row);
    terminate_progress_report(&progress);
 
    return (VIO_OK);
    }
 
-/* do projections from FFT'd data */
+/* prepare a real-valued working copy of a volume for real-to-real transforms */
+VIO_Status prep_real_volume(VIO_Volume *in_vol, VIO_Volume *out_vol, char *spatial_dimorder[]){
+   int      i, j;
+   VIO_Real     min, max;
+   voxel_converter conv;
+   double  *row;
+
+   int      sizes[3];
+   VIO_Real     starts[3];
+   VIO_Real     separations[3];
+   VIO_Real     tmp_dircos[3];
+
+   get_volume_sizes(*in_vol, sizes);
+   get_volume_starts(*in_vol, starts);
+   get_volume_separations(*in_vol, separations);
+   get_volume_real_range(*in_vol, &min, &max);
+
+   /* define new out_vol VIO_Volume  */
+   *out_vol = create_volume(3, spatial_dimorder, NC_FLOAT, TRUE, 0.0, 0.0);
+   set_volume_sizes(*out_vol, sizes);
+   set_volume_starts(*out_vol, starts);
+   set_volume_separations(*out_vol, separations);
+   set_volume_real_range(*out_vol, min, max);
+
+   /* copy over the direction cosines for x, y and z */
+   for(i = 0; i < 3; i++){
+      get_volume_direction_cosine(*in_vol, i, tmp_dircos);
+      set_volume_direction_cosine(*out_vol, i, tmp_dircos);
+      }
+
+   /* allocate space for out_vol */
+   alloc_volume_data(*out_vol);
+
+   init_voxel_converter(&conv, *in_vol);
+   row = (double *) malloc(sizes[2] * sizeof(double));
+   for(i = 0; i < sizes[0]; i++){
+      for(j = 0; j < sizes[1]; j++){
+         get_volume_row(&conv, *in_vol, i, j, row);
+         set_volume_row(*out_vol, i, j, row, 1.0);
+         }
+      }
+   free(row);
+
+   return (VIO_OK);
+   }
+
+/* convert a complex value to the requested output type */
+VIO_Real proj_value(VIO_Real real, VIO_Real imag, int job){
+   VIO_Real value;
+
+   switch (job){
+   default:
+   case OUTPUT_MAGNITUDE:
+      value = sqrt((real * real) + (imag * imag));
+      break;
+
+   case OUTPUT_PHASE:
+      if(real != 0.0){
+         value = atan(imag / real);
+         }
+      else {
+         value = 0.0;
+         }
+      break;
+
+   case OUTPUT_MAGLN:
+      value = sqrt(real * real + imag * imag);
+      if(value > 0.1)
+         value = log(value);
+      else
+         value = -2.3;
+      break;
+
+   case OUTPUT_MAG10:
+      value = sqrt(real * real + imag * imag);
+      if(value > 0.1)
+         value = log10(value);
+      else
+         value = -1;
+      break;
+
+   case OUTPUT_POWER:
+      value = (real * real) + (imag * imag);
+      break;
+
+   case OUTPUT_REAL:
+      value = real;
+      break;
+
+   case OUTPUT_IMAG:
+      value = imag;
+      break;
+
+      }
+
+   return value;
+   }
+
+/* do projections from FFT'd data, 3D (real) input volumes have no imaginary part */
 VIO_Status proj_volume(VIO_Volume *in_vol, VIO_Volume *out_vol, nc_type dtype, char *spatial_dimorder[], int job){
 
    int i, j, k;
+   int is_complex;
    VIO_Real value, real, imag;
    VIO_Real min, max;
 
@@ -86,6 +208,7 @@ VIO_Status proj_volume(VIO_Volume *in_vol, VIO_Volume *out_vol, nc_type dtype, c
    get_volume_sizes(*in_vol, sizes);
    get_volume_starts(*in_vol, starts);
    get_volume_separations(*in_vol, separations);
+   is_complex = (get_volume_n_dimensions(*in_vol) == 4);
 
    /* define new out_vol VIO_Volume  */
    *out_vol = create_volume(3, spatial_dimorder, dtype, TRUE, 0.0, 0.0);
@@ -111,50 +234,8 @@ VIO_Status proj_volume(VIO_Volume *in_vol, VIO_Volume *out_vol, nc_type dtype, c
          for(k = sizes[2]; k--;){
 
             real = get_volume_real_value(*in_vol, i, j, k, 0, 0);
-            imag = get_volume_real_value(*in_vol, i, j, k, 1, 0);
-
-            switch (job){
-            default:
-            case OUTPUT_MAGNITUDE:
-               value = sqrt((real * real) + (imag * imag));
-               break;
-
-            case OUTPUT_PHASE:
-               if(real != 0.0){
-                  value = atan(imag / real);
-                  }
-               else {
-                  value = 0.0;
-                  }
-               break;
-
-            case OUTPUT_MAGLN:
-               if(value > 0.1)
-                  value = log(sqrt(real * real + imag * imag));
-               else
-                  value = -2.3;
-               break;
-
-            case OUTPUT_MAG10:
-               if(value > 0.1)
-                  value = log10(sqrt(real * real + imag * imag));
-               else
-                  value = -1;
-               break;
-
-            case OUTPUT_POWER:
-               value = (real * real) + (imag * imag);
-               break;
-
-            case OUTPUT_REAL:
-               value = real;
-               break;
-
-            case OUTPUT_IMAG:
-               value = imag;
-               break;
-
-               }
+            imag = (is_complex) ? get_volume_real_value(*in_vol, i, j, k, 1, 0) : 0.0;
+            value = proj_value(real, imag, job);
 
             if(value < min){
                min = value;
@@ -216,10 +297,11 @@ VIO_Status fft_volume(VIO_Volume data, int inverse_flg, int dim, int centre){
 VIO_Status fft_volume_1d(VIO_Volume data, int inverse_flg, int centre){
    int i, j, k;
    int sizes[4];
-   VIO_Real value;
    VIO_Real factor;
    VIO_Real divisor;
    VIO_progress_struct progress;
+   voxel_converter conv;
+   double *row;
 
    fftw_complex *fftw_data;
    fftw_complex *fftw_data_ptr;
@@ -239,6 +321,8 @@ VIO_Status fft_volume_1d(VIO_Volume data, int inverse_flg, int centre){
 
    /* set up fftw data store */
    fftw_data = (fftw_complex *) malloc(sizes[2] * sizeof(fftw_complex));
+   row = (double *) malloc(sizes[2] * 2 * sizeof(double));
+   init_voxel_converter(&conv, data);
 
    /* setup an FFT plan */
    p = fftw_plan_dft_1d(sizes[2],
@@ -251,21 +335,19 @@ VIO_Status fft_volume_1d(VIO_Volume data, int inverse_flg, int centre){
       for(j = sizes[1]; j--;){
 
          /* do the super-funky shift to centre calculation if required */
-         fftw_data_ptr = fftw_data;
+         /* the column is stored last voxel first                      */
+         get_volume_row(&conv, data, i, j, row);
+         fftw_data_ptr = &fftw_data[sizes[2] - 1];
          factor = 1.0;
 
-         for(k = sizes[2]; k--;){
+         for(k = 0; k < sizes[2]; k++){
             if(centre){
-               factor = pow(-1.0, k);
+               factor = (k % 2) ? -1.0 : 1.0;
                }
 
-            GET_VOXEL_4D(value, data, i, j, k, 0);
-            c_re(*fftw_data_ptr) = (double)(value * factor);
-
-            GET_VOXEL_4D(value, data, i, j, k, 1);
-            c_im(*fftw_data_ptr) = (double)(value * factor);
-
-            fftw_data_ptr++;
+            c_re(*fftw_data_ptr) = row[2 * k] * factor;
+            c_im(*fftw_data_ptr) = row[2 * k + 1] * factor;
+            fftw_data_ptr--;
             }
 
          /* do the FFT using the existing plan */
@@ -273,12 +355,13 @@ VIO_Status fft_volume_1d(VIO_Volume data, int inverse_flg, int centre){
 
          /* put the data back */
          divisor = (inverse_flg) ? sizes[2] : 1.0;
-         fftw_data_ptr = fftw_data;
-         for(k = sizes[2]; k--;){
-            SET_VOXEL_4D(data, i, j, k, 0, (VIO_Real) c_re(*fftw_data_ptr) / divisor);
-            SET_VOXEL_4D(data, i, j, k, 1, (VIO_Real) c_im(*fftw_data_ptr) / divisor);
-            fftw_data_ptr++;
+         fftw_data_ptr = &fftw_data[sizes[2] - 1];
+         for(k = 0; k < sizes[2]; k++){
+            row[2 * k] = c_re(*fftw_data_ptr);
+            row[2 * k + 1] = c_im(*fftw_data_ptr);
+            fftw_data_ptr--;
             }
+         set_volume_row(data, i, j, row, divisor);
          }
 
       update_progress_report(&progress, sizes[0] - i);
@@ -287,6 +370,7 @@ VIO_Status fft_volume_1d(VIO_Volume data, int inverse_flg, int centre){
    /* be tidy */
    fftw_destroy_plan(p);
    free(fftw_data);
+   free(row);
    terminate_progress_report(&progress);
 
    return (VIO_OK);
@@ -299,8 +383,10 @@ VIO_Status fft_volume_2d(VIO_Volume data, int inverse_flg, int centre)
 
    int      i, j, k;
    int      sizes[4];
-   VIO_Real     value, factor, divisor;
+   VIO_Real     factor, divisor;
    VIO_progress_struct progress;
+   voxel_converter conv;
+   double  *row;
 
    fftw_complex *fftw_data;
    fftw_complex *fftw_data_ptr;
@@ -320,6 +406,8 @@ VIO_Status fft_volume_2d(VIO_Volume data, int inverse_flg, int centre)
 
    /* set up tmp data store */
    fftw_data = (fftw_complex *) malloc(sizes[1] * sizes[2] * sizeof(fftw_complex));
+   row = (double *) malloc(sizes[2] * 2 * sizeof(double));
+   init_voxel_converter(&conv, data);
 
    /* setup an FFT plan */
    p = fftw_plan_dft_2d(sizes[1], sizes[2],
@@ -331,21 +419,20 @@ VIO_Status fft_volume_2d(VIO_Volume data, int inverse_flg, int centre)
    for(i = sizes[0]; i--;){
 
       /* do the super-funky shift to centre calculation if required */
-      fftw_data_ptr = fftw_data;
+      /* the slice is stored last voxel first                       */
       factor = 1.0;
-      for(j = sizes[1]; j--;){
-         for(k = sizes[2]; k--;){
+      for(j = 0; j < sizes[1]; j++){
+         get_volume_row(&conv, data, i, j, row);
+         fftw_data_ptr = &fftw_data[(sizes[1] - j) * sizes[2] - 1];
+
+         for(k = 0; k < sizes[2]; k++){
             if(centre){
-               factor = pow(-1.0, j + k);
+               factor = ((j + k) % 2) ? -1.0 : 1.0;
                }
 
-            GET_VOXEL_4D(value, data, i, j, k, 0);
-            c_re(*fftw_data_ptr) = (double) (value * factor);
-
-            GET_VOXEL_4D(value, data, i, j, k, 1);
-            c_im(*fftw_data_ptr) = (double) (value * factor);
-
-            fftw_data_ptr++;
+            c_re(*fftw_data_ptr) = row[2 * k] * factor;
+            c_im(*fftw_data_ptr) = row[2 * k + 1] * factor;
+            fftw_data_ptr--;
             }
          }
 
@@ -355,13 +442,14 @@ VIO_Status fft_volume_2d(VIO_Volume data, int inverse_flg, int centre)
       /* put the data back */
       divisor = (inverse_flg) ? sizes[1] * sizes[2] : 1.0;
 
-      fftw_data_ptr = fftw_data;
-      for(j = sizes[1]; j--;){
-         for(k = sizes[2]; k--;){
-            SET_VOXEL_4D(data, i, j, k, 0, (VIO_Real) c_re(*fftw_data_ptr) / divisor);
-            SET_VOXEL_4D(data, i, j, k, 1, (VIO_Real) c_im(*fftw_data_ptr) / divisor);
-            fftw_data_ptr++;
+      for(j = 0; j < sizes[1]; j++){
+         fftw_data_ptr = &fftw_data[(sizes[1] - j) * sizes[2] - 1];
+         for(k = 0; k < sizes[2]; k++){
+            row[2 * k] = c_re(*fftw_data_ptr);
+            row[2 * k + 1] = c_im(*fftw_data_ptr);
+            fftw_data_ptr--;
             }
+         set_volume_row(data, i, j, row, divisor);
          }
 
       update_progress_report(&progress, sizes[0] - i);
@@ -370,6 +458,7 @@ VIO_Status fft_volume_2d(VIO_Volume data, int inverse_flg, int centre)
    /* be tidy */
    fftw_destroy_plan(p);
    free(fftw_data);
+   free(row);
    terminate_progress_report(&progress);
 
    return (VIO_OK);
@@ -380,8 +469,10 @@ VIO_Status fft_volume_3d(VIO_Volume data, int inverse_flg, int centre)
 {
    int      i, j, k;
    int      sizes[4];
-   VIO_Real     value, factor, divisor;
+   VIO_Real     factor, divisor;
    VIO_progress_struct progress;
+   voxel_converter conv;
+   double  *row;
 
    fftw_complex *fftw_data;
    fftw_complex *fftw_data_ptr;
@@ -402,58 +493,986 @@ VIO_Status fft_volume_3d(VIO_Volume data, int inverse_flg, int centre)
    /* set up tmp data store */
    fftw_data =
       (fftw_complex *) fftw_malloc(sizes[0] * sizes[1] * sizes[2] * sizeof(fftw_complex));
+   row = (double *) malloc(sizes[2] * 2 * sizeof(double));
+   init_voxel_converter(&conv, data);
+
+   /* plan before filling, measuring overwrites the buffer */
+   p = fftw_plan_dft_3d(sizes[0], sizes[1], sizes[2],
+                          fftw_data, fftw_data,
+                          (inverse_flg) ? FFTW_BACKWARD : FFTW_FORWARD,
+                          fft_planner);
 
    /* do the super-funky shift to centre calculation if required */
-   fftw_data_ptr = fftw_data;
+   /* the volume is stored last voxel first                      */
    factor = 1.0;
+   for(i = 0; i < sizes[0]; i++){
+      for(j = 0; j < sizes[1]; j++){
+         get_volume_row(&conv, data, i, j, row);
+         fftw_data_ptr = &fftw_data[((sizes[0] - i) * sizes[1] - j) * sizes[2] - 1];
+
+         for(k = 0; k < sizes[2]; k++){
+            if(centre){
+               factor = ((i + j + k) % 2) ? -1.0 : 1.0;
+               }
+
+            c_re(*fftw_data_ptr) = row[2 * k] * factor;
+            c_im(*fftw_data_ptr) = row[2 * k + 1] * factor;
+            fftw_data_ptr--;
+            }
+         }
+      update_progress_report(&progress, i + 1);
+      }
+
+   /* do the FFT */
+   fftw_execute(p);
+   update_progress_report(&progress, sizes[0] * 2);
+
+   /* put the data back */
+   divisor = (inverse_flg) ? sizes[0] * sizes[1] * sizes[2] : 1.0;
+
+   for(i = 0; i < sizes[0]; i++){
+      for(j = 0; j < sizes[1]; j++){
+         fftw_data_ptr = &fftw_data[((sizes[0] - i) * sizes[1] - j) * sizes[2] - 1];
+         for(k = 0; k < sizes[2]; k++){
+            row[2 * k] = c_re(*fftw_data_ptr);
+            row[2 * k + 1] = c_im(*fftw_data_ptr);
+            fftw_data_ptr--;
+            }
+         set_volume_row(data, i, j, row, divisor);
+         }
+      update_progress_report(&progress, (sizes[0] * 2) + i + 1);
+      }
+
+   /* be tidy */
+   fftw_destroy_plan(p);
+   fftw_free(fftw_data);
+   free(row);
+   terminate_progress_report(&progress);
+
+   return (VIO_OK);
+   }
+
+/* set the real range of a 3 or 4D volume from its data */
+void calc_volume_range(VIO_Volume data){
+   int      i, j, k, l;
+   int      sizes[4];
+   VIO_Real     value, min, max;
+
+   sizes[3] = 1;
+   get_volume_sizes(data, sizes);
+
+   min = DBL_MAX;
+   max = -DBL_MAX;
    for(i = sizes[0]; i--;){
       for(j = sizes[1]; j--;){
          for(k = sizes[2]; k--;){
-            if(centre){
-               factor = pow(-1.0, i + j + k);
+            for(l = sizes[3]; l--;){
+
+               value = get_volume_real_value(data, i, j, k, l, 0);
+               if(value > max){
+                  max = value;
+                  }
+               if(value < min){
+                  min = value;
+                  }
                }
+            }
+         }
+      }
+
+   set_volume_real_range(data, min, max);
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : r2r_volume
+@INPUT      : data - a real (3D) VIO_Volume as from prep_real_volume
+              type = FFT_TYPE_DCT or FFT_TYPE_DST
+              inverse_flg = TRUE if inverse transform to be done.
+              dim = number of (fastest varying) dimensions to transform
+@RETURNS    : status variable - OK or ERROR.
+@DESCRIPTION: forward transforms are DCT-II/DST-II (even/odd symmetry about
+              the voxel edges), inverses are DCT-III/DST-III scaled by 1/2N
+              per dimension so that forward then inverse is the identity.
+ */
+VIO_Status r2r_volume(VIO_Volume data, int type, int inverse_flg, int dim){
+   int      i, j;
+   int      sizes[3];
+   int      n_transforms;
+   VIO_Real     divisor;
+   VIO_progress_struct progress;
+   voxel_converter conv;
 
-            GET_VOXEL_4D(value, data, i, j, k, 0);
-            c_re(*fftw_data_ptr) = (double) (value * factor);
+   double  *r2r_data;
+   fftw_r2r_kind kinds[3];
+   fftw_plan p;
 
-            GET_VOXEL_4D(value, data, i, j, k, 1);
-            c_im(*fftw_data_ptr) = (double) (value * factor);
+   get_volume_sizes(data, sizes);
 
-            fftw_data_ptr++;
-            }
+   if(dim < 1 || dim > 3){
+      fprintf(stderr, "Glark! I canna do %d dimensional DCT's or DST's yet!\n", dim);
+      return (VIO_ERROR);
+      }
+
+   for(i = 0; i < dim; i++){
+      if(type == FFT_TYPE_DST){
+         kinds[i] = (inverse_flg) ? FFTW_RODFT01 : FFTW_RODFT10;
+         }
+      else {
+         kinds[i] = (inverse_flg) ? FFTW_REDFT01 : FFTW_REDFT10;
          }
-      update_progress_report(&progress, sizes[0] - i);
       }
 
-   /* do the FFT */
-   p = fftw_plan_dft_3d(sizes[0], sizes[1], sizes[2],
-                          fftw_data, fftw_data,
-                          (inverse_flg) ? FFTW_BACKWARD : FFTW_FORWARD,
-                          FFTW_ESTIMATE);
+   initialize_progress_report(&progress, FALSE, sizes[0] * 3, "R2R");
 
+   /* set up tmp data store */
+   r2r_data = (double *) fftw_malloc(sizes[0] * sizes[1] * sizes[2] * sizeof(double));
 
+   /* one plan for all columns (1D), slices (2D) or the whole volume (3D) */
+   n_transforms = 1;
+   divisor = 1.0;
+   for(i = 0; i < 3; i++){
+      if(i < 3 - dim){
+         n_transforms *= sizes[i];
+         }
+      else if(inverse_flg){
+         divisor *= 2.0 * sizes[i];
+         }
+      }
+   p = fftw_plan_many_r2r(dim, &sizes[3 - dim], n_transforms,
+                          r2r_data, NULL, 1, (sizes[0] * sizes[1] * sizes[2]) / n_transforms,
+                          r2r_data, NULL, 1, (sizes[0] * sizes[1] * sizes[2]) / n_transforms,
+                          kinds, fft_planner);
+
+   init_voxel_converter(&conv, data);
+   for(i = 0; i < sizes[0]; i++){
+      for(j = 0; j < sizes[1]; j++){
+         get_volume_row(&conv, data, i, j, &r2r_data[(i * sizes[1] + j) * sizes[2]]);
+         }
+      update_progress_report(&progress, i + 1);
+      }
+
+   /* do the transform */
    fftw_execute(p);
    update_progress_report(&progress, sizes[0] * 2);
 
    /* put the data back */
-   divisor = (inverse_flg) ? sizes[0] * sizes[1] * sizes[2] : 1.0;
+   for(i = 0; i < sizes[0]; i++){
+      for(j = 0; j < sizes[1]; j++){
+         set_volume_row(data, i, j, &r2r_data[(i * sizes[1] + j) * sizes[2]], divisor);
+         }
+      update_progress_report(&progress, (sizes[0] * 2) + i + 1);
+      }
+
+   /* be tidy */
+   fftw_destroy_plan(p);
+   fftw_free(r2r_data);
+   terminate_progress_report(&progress);
+
+   return (VIO_OK);
+   }
+
+/* frequencies common to an axis of length n_old and one of length n_new */
+/* returns the number of entries and for each its index in the old and new */
+/* spectrum (FFTW order) and a weight. If the shorter length is even its   */
+/* Nyquist bin is shared by +N/2 and -N/2: zero-filling splits the old bin */
+/* half-and-half between them, truncating folds both into the new bin.     */
+/* half = TRUE for the last (non-redundant half) axis of an r2c transform, */
+/* only +N/2 is stored there so truncation is folded by the caller         */
+static int resample_axis_map(int n_old, int n_new, int half, int *src, int *dst, double *weight){
+   int f, h, m, n;
+
+   m = (n_old < n_new) ? n_old : n_new;
+   h = (m - 1) / 2;
+
+   n = 0;
+   for(f = (half) ? 0 : -h; f <= h; f++){
+      src[n] = (f < 0) ? f + n_old : f;
+      dst[n] = (f < 0) ? f + n_new : f;
+      weight[n] = 1.0;
+      n++;
+      }
+
+   if(m % 2 == 0){
+      src[n] = m / 2;
+      dst[n] = m / 2;
+      weight[n] = (n_old < n_new) ? 0.5 : 1.0;
+      n++;
+      if(!half && n_old < n_new){
+         src[n] = m / 2;
+         dst[n] = n_new - m / 2;
+         weight[n] = 0.5;
+         n++;
+         }
+      else if(!half && n_old > n_new){
+         src[n] = n_old - m / 2;
+         dst[n] = m / 2;
+         weight[n] = 1.0;
+         n++;
+         }
+      }
+
+   return n;
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : resample_volume
+@INPUT      : data - a 3D (real) or 4D (complex) VIO_Volume
+              new_sizes - the output sizes in volume dimension order
+@OUTPUT     : data - replaced by the resampled volume
+@RETURNS    : status variable - OK or ERROR.
+@DESCRIPTION: Fourier (sinc) resampling, the volume is forward transformed,
+              the spectrum zero-filled or truncated to the new grid and then
+              inverse transformed. Real volumes use r2c/c2r transforms, the
+              field of view is preserved so starts and separations change.
+ */
+VIO_Status resample_volume(VIO_Volume *data, int new_sizes[]){
+   int      i, j, k, c, n;
+   int      is_complex;
+   int      sizes[4];
+   int      out_sizes[4];
+   int      n_map[3];
+   int     *src_map[3];
+   int     *dst_map[3];
+   double  *weight_map[3];
+   int      old_n2, new_n2;
+   int      ci, cj, idx;
+   double   w;
+   VIO_Real     value, divisor;
+   VIO_Real     starts[4];
+   VIO_Real     separations[4];
+   VIO_Real     tmp_dircos[3];
+   VIO_STR     *dim_names;
+   VIO_Volume   new_vol;
+   VIO_progress_struct progress;
+   voxel_converter conv;
+
+   double       *real_data;
+   fftw_complex *old_spec;
+   fftw_complex *new_spec;
+   fftw_complex *plane;
+   fftw_plan p;
+
+   sizes[3] = 1;
+   get_volume_sizes(*data, sizes);
+   get_volume_starts(*data, starts);
+   get_volume_separations(*data, separations);
+   is_complex = (get_volume_n_dimensions(*data) == 4);
+
+   for(c = 0; c < 3; c++){
+      if(new_sizes[c] < 1){
+         fprintf(stderr, "resample_volume: invalid size (%d)\n", new_sizes[c]);
+         return (VIO_ERROR);
+         }
+      }
+
+   initialize_progress_report(&progress, FALSE, 4, "Resample");
+
+   /* real volumes only store the non-redundant half of the last axis */
+   old_n2 = (is_complex) ? sizes[2] : sizes[2] / 2 + 1;
+   new_n2 = (is_complex) ? new_sizes[2] : new_sizes[2] / 2 + 1;
 
+   /* forward transform */
+   init_voxel_converter(&conv, *data);
+   old_spec = (fftw_complex *) fftw_malloc(sizes[0] * sizes[1] * old_n2 * sizeof(fftw_complex));
+   if(is_complex){
+      p = fftw_plan_dft_3d(sizes[0], sizes[1], sizes[2],
+                           old_spec, old_spec, FFTW_FORWARD, fft_planner);
+
+      /* a row of a complex volume is interleaved real, imag as FFTW wants */
+      for(i = 0; i < sizes[0]; i++){
+         for(j = 0; j < sizes[1]; j++){
+            get_volume_row(&conv, *data, i, j, (double *) old_spec[(i * sizes[1] + j) * sizes[2]]);
+            }
+         }
+      fftw_execute(p);
+      fftw_destroy_plan(p);
+      }
+   else {
+      real_data = (double *) fftw_malloc(sizes[0] * sizes[1] * sizes[2] * sizeof(double));
+      p = fftw_plan_dft_r2c_3d(sizes[0], sizes[1], sizes[2],
+                               real_data, old_spec, fft_planner);
+      for(i = 0; i < sizes[0]; i++){
+         for(j = 0; j < sizes[1]; j++){
+            get_volume_row(&conv, *data, i, j, &real_data[(i * sizes[1] + j) * sizes[2]]);
+            }
+         }
+      fftw_execute(p);
+      fftw_destroy_plan(p);
+      fftw_free(real_data);
+      }
+   update_progress_report(&progress, 1);
+
+   /* zero-fill or truncate the spectrum onto the new grid */
+   for(c = 0; c < 3; c++){
+      n = ((sizes[c] > new_sizes[c]) ? sizes[c] : new_sizes[c]) + 1;
+      src_map[c] = (int *) malloc(n * sizeof(int));
+      dst_map[c] = (int *) malloc(n * sizeof(int));
+      weight_map[c] = (double *) malloc(n * sizeof(double));
+      n_map[c] = resample_axis_map(sizes[c], new_sizes[c], (c == 2 && !is_complex),
+                                   src_map[c], dst_map[c], weight_map[c]);
+      }
+
+   /* plan the inverse before filling, measuring overwrites the buffers */
+   new_spec = (fftw_complex *) fftw_malloc(new_sizes[0] * new_sizes[1] * new_n2 * sizeof(fftw_complex));
+   if(is_complex){
+      p = fftw_plan_dft_3d(new_sizes[0], new_sizes[1], new_sizes[2],
+                           new_spec, new_spec, FFTW_BACKWARD, fft_planner);
+      }
+   else {
+      real_data = (double *) fftw_malloc(new_sizes[0] * new_sizes[1] * new_sizes[2] * sizeof(double));
+      p = fftw_plan_dft_c2r_3d(new_sizes[0], new_sizes[1], new_sizes[2],
+                               new_spec, real_data, fft_planner);
+      }
+   memset(new_spec, 0, new_sizes[0] * new_sizes[1] * new_n2 * sizeof(fftw_complex));
+   for(i = 0; i < n_map[0]; i++){
+      for(j = 0; j < n_map[1]; j++){
+         for(k = 0; k < n_map[2]; k++){
+            w = weight_map[0][i] * weight_map[1][j] * weight_map[2][k];
+            c_re(new_spec[(dst_map[0][i] * new_sizes[1] + dst_map[1][j]) * new_n2 + dst_map[2][k]]) +=
+               w * c_re(old_spec[(src_map[0][i] * sizes[1] + src_map[1][j]) * old_n2 + src_map[2][k]]);
+            c_im(new_spec[(dst_map[0][i] * new_sizes[1] + dst_map[1][j]) * new_n2 + dst_map[2][k]]) +=
+               w * c_im(old_spec[(src_map[0][i] * sizes[1] + src_map[1][j]) * old_n2 + src_map[2][k]]);
+            }
+         }
+      }
+   fftw_free(old_spec);
+   for(c = 0; c < 3; c++){
+      free(src_map[c]);
+      free(dst_map[c]);
+      free(weight_map[c]);
+      }
+
+   /* truncating the half axis to an even length, -N/2 is not stored but  */
+   /* is the conjugate of +N/2 mirrored on the other axes, fold it in too */
+   if(!is_complex && new_sizes[2] < sizes[2] && new_sizes[2] % 2 == 0){
+      plane = (fftw_complex *) malloc(new_sizes[0] * new_sizes[1] * sizeof(fftw_complex));
+      for(i = 0; i < new_sizes[0]; i++){
+         for(j = 0; j < new_sizes[1]; j++){
+            idx = (i * new_sizes[1] + j) * new_n2 + new_n2 - 1;
+            c_re(plane[i * new_sizes[1] + j]) = c_re(new_spec[idx]);
+            c_im(plane[i * new_sizes[1] + j]) = c_im(new_spec[idx]);
+            }
+         }
+      for(i = 0; i < new_sizes[0]; i++){
+         ci = (new_sizes[0] - i) % new_sizes[0];
+         for(j = 0; j < new_sizes[1]; j++){
+            cj = (new_sizes[1] - j) % new_sizes[1];
+            idx = (i * new_sizes[1] + j) * new_n2 + new_n2 - 1;
+            c_re(new_spec[idx]) = c_re(plane[i * new_sizes[1] + j]) + c_re(plane[ci * new_sizes[1] + cj]);
+            c_im(new_spec[idx]) = c_im(plane[i * new_sizes[1] + j]) - c_im(plane[ci * new_sizes[1] + cj]);
+            }
+         }
+      free(plane);
+      }
+   update_progress_report(&progress, 2);
+
+   /* preserve the field of view, the outer voxel edges stay put */
+   for(c = 0; c < 3; c++){
+      value = separations[c] * sizes[c] / new_sizes[c];
+      starts[c] += (value - separations[c]) / 2.0;
+      separations[c] = value;
+      }
+
+   /* define the new VIO_Volume */
+   dim_names = get_volume_dimension_names(*data);
+   new_vol = create_volume((is_complex) ? 4 : 3, dim_names, NC_FLOAT, TRUE, 0.0, 0.0);
+   delete_dimension_names(*data, dim_names);
+
+   for(c = 0; c < 3; c++){
+      out_sizes[c] = new_sizes[c];
+      }
+   out_sizes[3] = sizes[3];
+   set_volume_sizes(new_vol, out_sizes);
+   set_volume_starts(new_vol, starts);
+   set_volume_separations(new_vol, separations);
+   for(c = 0; c < 3; c++){
+      get_volume_direction_cosine(*data, c, tmp_dircos);
+      set_volume_direction_cosine(new_vol, c, tmp_dircos);
+      }
+   alloc_volume_data(new_vol);
+
+   /* inverse transform onto the new grid */
+   divisor = (VIO_Real) sizes[0] * sizes[1] * sizes[2];
+   if(is_complex){
+      fftw_execute(p);
+      fftw_destroy_plan(p);
+      update_progress_report(&progress, 3);
+
+      for(i = 0; i < new_sizes[0]; i++){
+         for(j = 0; j < new_sizes[1]; j++){
+            set_volume_row(new_vol, i, j,
+                           (double *) new_spec[(i * new_sizes[1] + j) * new_sizes[2]], divisor);
+            }
+         }
+      }
+   else {
+      fftw_execute(p);
+      fftw_destroy_plan(p);
+      update_progress_report(&progress, 3);
+
+      for(i = 0; i < new_sizes[0]; i++){
+         for(j = 0; j < new_sizes[1]; j++){
+            set_volume_row(new_vol, i, j,
+                           &real_data[(i * new_sizes[1] + j) * new_sizes[2]], divisor);
+            }
+         }
+      fftw_free(real_data);
+      }
+
+   /* be tidy */
+   fftw_free(new_spec);
+   delete_volume(*data);
+   *data = new_vol;
+   terminate_progress_report(&progress);
+
+   return (VIO_OK);
+   }
+
+/* check that the spectrum of a 4D volume is Hermitian (X[-f] = conj(X[f])) */
+/* over the dim fastest varying dimensions, ie: that its inverse is real.   */
+/* The FFT routines fill their buffers in reverse voxel order so voxel k    */
+/* holds frequency n-1-k and its conjugate partner is at voxel n-2-k.       */
+/* Each pair must agree to float precision of its own size (plus a floor   */
+/* from the RMS for bins that should be zero), the first mismatch stops    */
+/* the check so spectra that are not Hermitian cost little.                */
+int is_hermitian_volume(VIO_Volume data, int dim){
+   int      i, j, k;
+   int      ci, cj, ck;
+   int      sizes[4];
+   int      hermitian;
+   double   re, im, c_re_val, c_im_val;
+   double   sum_sq, floor_diff;
+   double  *row, *c_row;
+   voxel_converter conv;
+
+   get_volume_sizes(data, sizes);
+   row = (double *) malloc(sizes[2] * 2 * sizeof(double));
+   c_row = (double *) malloc(sizes[2] * 2 * sizeof(double));
+   init_voxel_converter(&conv, data);
+
+   /* RMS of the spectrum for the absolute floor */
+   sum_sq = 0.0;
+   for(i = 0; i < sizes[0]; i++){
+      for(j = 0; j < sizes[1]; j++){
+         get_volume_row(&conv, data, i, j, row);
+         for(k = 0; k < 2 * sizes[2]; k++){
+            sum_sq += row[k] * row[k];
+            }
+         }
+      }
+   floor_diff = 4.0 * FLT_EPSILON * sqrt(sum_sq / ((double) sizes[0] * sizes[1] * sizes[2]));
+
+   hermitian = TRUE;
+   for(i = 0; i < sizes[0] && hermitian; i++){
+      ci = (dim < 3) ? i : (2 * sizes[0] - 2 - i) % sizes[0];
+      for(j = 0; j < sizes[1] && hermitian; j++){
+         cj = (dim < 2) ? j : (2 * sizes[1] - 2 - j) % sizes[1];
+
+         get_volume_row(&conv, data, i, j, row);
+         get_volume_row(&conv, data, ci, cj, c_row);
+         for(k = 0; k < sizes[2]; k++){
+            ck = (2 * sizes[2] - 2 - k) % sizes[2];
+
+            re = row[2 * k];
+            im = row[2 * k + 1];
+            c_re_val = c_row[2 * ck];
+            c_im_val = c_row[2 * ck + 1];
+
+            if(fabs(re - c_re_val) + fabs(im + c_im_val) >
+               4.0 * FLT_EPSILON * (fabs(re) + fabs(im) + fabs(c_re_val) + fabs(c_im_val)) +
+               floor_diff){
+               hermitian = FALSE;
+               break;
+               }
+            }
+         }
+      }
+
+   free(row);
+   free(c_row);
+   return (hermitian);
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : fft_volume_c2r
+@INPUT      : data - a 4D (complex) VIO_Volume holding a Hermitian spectrum
+              dim = number of (fastest varying) dimensions to transform
+              centre = TRUE if the spectrum is centred
+@OUTPUT     : data - replaced by the real 3D result
+@RETURNS    : status variable - OK or ERROR.
+@DESCRIPTION: inverse FFT using a complex-to-real transform, only the
+              non-redundant half of the spectrum is read and the 1/N
+              normalisation is applied as the result is copied back.
+ */
+VIO_Status fft_volume_c2r(VIO_Volume *data, int dim, int centre){
+   int      i, j, k, c;
+   int      vi, vj, vk;
+   int      sizes[4];
+   int      half_n2;
+   int      n_transforms;
+   VIO_Real     factor, divisor;
+   VIO_Real     starts[4];
+   VIO_Real     separations[4];
+   VIO_Real     tmp_dircos[3];
+   VIO_STR     *dim_names;
+   VIO_Volume   new_vol;
+   VIO_progress_struct progress;
+   voxel_converter conv;
+   double      *row;
+
+   fftw_complex *fftw_data;
+   fftw_complex *fftw_data_ptr;
+   double       *real_data;
+   double       *real_data_ptr;
+   fftw_plan p;
+
+   get_volume_sizes(*data, sizes);
+   get_volume_starts(*data, starts);
+   get_volume_separations(*data, separations);
+
+   if(dim < 1 || dim > 3){
+      fprintf(stderr, "Glark! I canna do %d dimensional FFT's yet!\n", dim);
+      return (VIO_ERROR);
+      }
+
+   /* check that sizes are even if shifting to centre */
+   for(c = 3 - dim; c < 3; c++){
+      if(centre && (sizes[c] % 2 != 0)){
+         fprintf(stderr,
+                 "fft_volume_c2r: all FFT lengths must be even if using -centre\n\n");
+         exit(EXIT_FAILURE);
+         }
+      }
+
+   initialize_progress_report(&progress, FALSE, sizes[0] * 3, "FFT");
+
+   /* set up tmp data stores, only the first half of the last axis is needed */
+   half_n2 = sizes[2] / 2 + 1;
+   fftw_data = (fftw_complex *) fftw_malloc(sizes[0] * sizes[1] * half_n2 * sizeof(fftw_complex));
+   real_data = (double *) fftw_malloc(sizes[0] * sizes[1] * sizes[2] * sizeof(double));
+
+   /* one plan for all columns (1D), slices (2D) or the whole volume (3D) */
+   n_transforms = 1;
+   divisor = 1.0;
+   for(c = 0; c < 3; c++){
+      if(c < 3 - dim){
+         n_transforms *= sizes[c];
+         }
+      else {
+         divisor *= sizes[c];
+         }
+      }
+   p = fftw_plan_many_dft_c2r(dim, &sizes[3 - dim], n_transforms,
+                              fftw_data, NULL, 1, (sizes[0] * sizes[1] * half_n2) / n_transforms,
+                              real_data, NULL, 1, (sizes[0] * sizes[1] * sizes[2]) / n_transforms,
+                              fft_planner);
+
+   /* do the super-funky shift to centre calculation if required */
+   /* voxels are read in the same (reversed) order as fft_volume_Nd */
+   init_voxel_converter(&conv, *data);
+   row = (double *) malloc(sizes[2] * 2 * sizeof(double));
    fftw_data_ptr = fftw_data;
-   for(i = sizes[0]; i--;){
-      for(j = sizes[1]; j--;){
-         for(k = sizes[2]; k--;){
-            SET_VOXEL_4D(data, i, j, k, 0, (VIO_Real) c_re(*fftw_data_ptr) / divisor);
-            SET_VOXEL_4D(data, i, j, k, 1, (VIO_Real) c_im(*fftw_data_ptr) / divisor);
+   factor = 1.0;
+   for(i = 0; i < sizes[0]; i++){
+      vi = (dim > 2) ? sizes[0] - 1 - i : i;
+      for(j = 0; j < sizes[1]; j++){
+         vj = (dim > 1) ? sizes[1] - 1 - j : j;
+         get_volume_row(&conv, *data, vi, vj, row);
+         for(k = 0; k < half_n2; k++){
+            vk = sizes[2] - 1 - k;
+            if(centre){
+               factor = ((((dim > 2) ? vi : 0) + ((dim > 1) ? vj : 0) + vk) % 2) ? -1.0 : 1.0;
+               }
+
+            c_re(*fftw_data_ptr) = row[2 * vk] * factor;
+            c_im(*fftw_data_ptr) = row[2 * vk + 1] * factor;
             fftw_data_ptr++;
             }
          }
-      update_progress_report(&progress, (sizes[0] * 3) - i);
+      update_progress_report(&progress, i + 1);
       }
 
-   /* be tidy */
+   /* do the FFT */
+   fftw_execute(p);
    fftw_destroy_plan(p);
    fftw_free(fftw_data);
+   update_progress_report(&progress, sizes[0] * 2);
+
+   /* define the new (real) VIO_Volume */
+   dim_names = get_volume_dimension_names(*data);
+   new_vol = create_volume(3, dim_names, NC_FLOAT, TRUE, 0.0, 0.0);
+   delete_dimension_names(*data, dim_names);
+
+   set_volume_sizes(new_vol, sizes);
+   set_volume_starts(new_vol, starts);
+   set_volume_separations(new_vol, separations);
+   for(c = 0; c < 3; c++){
+      get_volume_direction_cosine(*data, c, tmp_dircos);
+      set_volume_direction_cosine(new_vol, c, tmp_dircos);
+      }
+   alloc_volume_data(new_vol);
+
+   /* put the data back, normalising as we go */
+   real_data_ptr = real_data;
+   for(i = 0; i < sizes[0]; i++){
+      vi = (dim > 2) ? sizes[0] - 1 - i : i;
+      for(j = 0; j < sizes[1]; j++){
+         vj = (dim > 1) ? sizes[1] - 1 - j : j;
+         for(k = 0; k < sizes[2]; k++){
+            row[sizes[2] - 1 - k] = *real_data_ptr;
+            real_data_ptr++;
+            }
+         set_volume_row(new_vol, vi, vj, row, divisor);
+         }
+      update_progress_report(&progress, (sizes[0] * 2) + i + 1);
+      }
+
+   /* be tidy */
+   free(row);
+   fftw_free(real_data);
+   delete_volume(*data);
+   *data = new_vol;
    terminate_progress_report(&progress);
 
    return (VIO_OK);
    }
+
+/* smallest size >= n with only small prime factors (fast for FFTW) */
+int fft_friendly_size(int n, int even){
+   int m, r;
+
+   for(m = (n < 1) ? 1 : n;; m++){
+      if(even && (m % 2 != 0)){
+         continue;
+         }
+      r = m;
+      while(r % 2 == 0) r /= 2;
+      while(r % 3 == 0) r /= 3;
+      while(r % 5 == 0) r /= 5;
+      while(r % 7 == 0) r /= 7;
+      if(r == 1){
+         return m;
+         }
+      }
+   }
+
+/* do two 3D volumes sample the same grid (sizes, starts, steps and       */
+/* direction cosines), starts may differ by a small fraction of a voxel    */
+int same_volume_grid(VIO_Volume a, VIO_Volume b){
+   int      c, i;
+   int      a_sizes[3], b_sizes[3];
+   VIO_Real a_starts[3], b_starts[3];
+   VIO_Real a_seps[3], b_seps[3];
+   VIO_Real a_dircos[3], b_dircos[3];
+
+   get_volume_sizes(a, a_sizes);
+   get_volume_sizes(b, b_sizes);
+   get_volume_starts(a, a_starts);
+   get_volume_starts(b, b_starts);
+   get_volume_separations(a, a_seps);
+   get_volume_separations(b, b_seps);
+
+   for(c = 0; c < 3; c++){
+      if(a_sizes[c] != b_sizes[c] ||
+         fabs(a_seps[c] - b_seps[c]) > 1e-6 * fabs(a_seps[c]) ||
+         fabs(a_starts[c] - b_starts[c]) > 1e-3 * fabs(a_seps[c])){
+         return FALSE;
+         }
+
+      get_volume_direction_cosine(a, c, a_dircos);
+      get_volume_direction_cosine(b, c, b_dircos);
+      for(i = 0; i < 3; i++){
+         if(fabs(a_dircos[i] - b_dircos[i]) > 1e-6){
+            return FALSE;
+            }
+         }
+      }
+
+   return TRUE;
+   }
+
+/* find the bounding box (inclusive) of voxels above threshold in a 3D volume */
+/* returns FALSE if no voxels are above threshold                             */
+int find_bounding_box(VIO_Volume data, VIO_Real threshold, int lo[], int hi[]){
+   int      i, j, k, c;
+   int      sizes[3];
+   VIO_Real     value;
+
+   get_volume_sizes(data, sizes);
+   for(c = 0; c < 3; c++){
+      lo[c] = sizes[c];
+      hi[c] = -1;
+      }
+
+   for(i = 0; i < sizes[0]; i++){
+      for(j = 0; j < sizes[1]; j++){
+         for(k = 0; k < sizes[2]; k++){
+            GET_VALUE_3D(value, data, i, j, k);
+            if(value > threshold){
+               if(i < lo[0]) lo[0] = i;
+               if(i > hi[0]) hi[0] = i;
+               if(j < lo[1]) lo[1] = j;
+               if(j > hi[1]) hi[1] = j;
+               if(k < lo[2]) lo[2] = k;
+               if(k > hi[2]) hi[2] = k;
+               }
+            }
+         }
+      }
+
+   return (hi[0] >= 0);
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : crop_volume
+@INPUT      : data - a 3D VIO_Volume
+              lo, hi - bounding box (inclusive) of the region to keep
+              margin - number of voxels to add around the bounding box
+              even - TRUE if the resulting sizes must be even (-centre)
+@OUTPUT     : data - replaced by the cropped volume
+@RETURNS    : status variable - OK or ERROR.
+@DESCRIPTION: the box is grown by margin, rounded up to an FFT friendly size
+              and kept within the volume, starts are shifted to match.
+ */
+VIO_Status crop_volume(VIO_Volume *data, int lo[], int hi[], int margin, int even){
+   int      i, j, k, c;
+   int      sizes[3];
+   int      offset[3];
+   int      new_sizes[3];
+   VIO_Real     value;
+   VIO_Real     min, max;
+   VIO_Real     starts[3];
+   VIO_Real     separations[3];
+   VIO_Real     tmp_dircos[3];
+   VIO_STR     *dim_names;
+   VIO_Volume   new_vol;
+
+   get_volume_sizes(*data, sizes);
+   get_volume_starts(*data, starts);
+   get_volume_separations(*data, separations);
+   get_volume_real_range(*data, &min, &max);
+
+   for(c = 0; c < 3; c++){
+      new_sizes[c] = fft_friendly_size(hi[c] - lo[c] + 1 + 2 * margin, even);
+
+      /* no point cropping an axis if we cannot make it smaller */
+      if(new_sizes[c] >= sizes[c]){
+         offset[c] = 0;
+         new_sizes[c] = sizes[c];
+         }
+      else{
+         offset[c] = (lo[c] + hi[c] + 1 - new_sizes[c]) / 2;
+         if(offset[c] + new_sizes[c] > sizes[c]){
+            offset[c] = sizes[c] - new_sizes[c];
+            }
+         if(offset[c] < 0){
+            offset[c] = 0;
+            }
+         }
+
+      starts[c] += offset[c] * separations[c];
+      }
+
+   /* define the new VIO_Volume */
+   dim_names = get_volume_dimension_names(*data);
+   new_vol = create_volume(3, dim_names, NC_FLOAT, TRUE, 0.0, 0.0);
+   delete_dimension_names(*data, dim_names);
+
+   set_volume_sizes(new_vol, new_sizes);
+   set_volume_starts(new_vol, starts);
+   set_volume_separations(new_vol, separations);
+   set_volume_real_range(new_vol, min, max);
+   for(c = 0; c < 3; c++){
+      get_volume_direction_cosine(*data, c, tmp_dircos);
+      set_volume_direction_cosine(new_vol, c, tmp_dircos);
+      }
+   alloc_volume_data(new_vol);
+
+   for(i = 0; i < new_sizes[0]; i++){
+      for(j = 0; j < new_sizes[1]; j++){
+         for(k = 0; k < new_sizes[2]; k++){
+            GET_VALUE_3D(value, *data, i + offset[0], j + offset[1], k + offset[2]);
+            set_volume_real_value(new_vol, i, j, k, 0, 0, value);
+            }
+         }
+      }
+
+   /* be tidy */
+   delete_volume(*data);
+   *data = new_vol;
+
+   return (VIO_OK);
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : derivative_volumes
+@INPUT      : in_vol - a real (3D) VIO_Volume
+              wanted - TRUE for each DERIV_* to calculate
+@OUTPUT     : out_vols - a real (3D) VIO_Volume for each wanted DERIV_*
+@RETURNS    : status variable - OK or ERROR.
+@DESCRIPTION: spectral derivatives from a single forward FFT. The angular
+              frequency of each bin in world coordinates is A^-T k, A has
+              columns separation * direction cosine and k is 2 pi m / N
+              along each voxel axis. Gradients (i w) are along world x, y
+              and z and ignore the Nyquist bins, the Laplacian is -|w|^2
+              and its inverse -1/|w|^2 (zero mean). Every output takes one
+              complex-to-real FFT with the same plan.
+ */
+VIO_Status derivative_volumes(VIO_Volume in_vol, int wanted[], VIO_Volume out_vols[]){
+   int      i, j, k, c, d, op;
+   int      sizes[3];
+   int      m[3];
+   int      half, n_bins;
+   size_t   idx;
+   VIO_Real     starts[3];
+   VIO_Real     separations[3];
+   VIO_Real     dircos[3][3];
+   double   a[3][3];                 /* world = A voxel */
+   double   w_mat[3][3];             /* A^-T */
+   double   det, kappa[3], w[3], w2, mult_re, mult_im, re, im, divisor;
+   VIO_STR     *dim_names;
+   voxel_converter conv;
+
+   double       *real_data;
+   double       *row;
+   fftw_complex *spec;
+   fftw_complex *work;
+   fftw_plan p;
+
+   get_volume_sizes(in_vol, sizes);
+   get_volume_starts(in_vol, starts);
+   get_volume_separations(in_vol, separations);
+   for(d = 0; d < 3; d++){
+      get_volume_direction_cosine(in_vol, d, dircos[d]);
+      }
+
+   /* invert the voxel to world matrix */
+   for(c = 0; c < 3; c++){
+      for(d = 0; d < 3; d++){
+         a[c][d] = separations[d] * dircos[d][c];
+         }
+      }
+   det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+         a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) +
+         a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+   if(fabs(det) < DBL_EPSILON){
+      fprintf(stderr, "derivative_volumes: degenerate separations or direction cosines\n");
+      return (VIO_ERROR);
+      }
+
+   /* A^-T is the cofactor matrix of A over det(A) */
+   for(c = 0; c < 3; c++){
+      for(d = 0; d < 3; d++){
+         w_mat[c][d] = (a[(c + 1) % 3][(d + 1) % 3] * a[(c + 2) % 3][(d + 2) % 3] -
+                        a[(c + 1) % 3][(d + 2) % 3] * a[(c + 2) % 3][(d + 1) % 3]) / det;
+         }
+      }
+
+   /* forward transform */
+   half = sizes[2] / 2 + 1;
+   n_bins = sizes[0] * sizes[1] * half;
+   real_data = (double *) fftw_malloc(sizes[0] * sizes[1] * sizes[2] * sizeof(double));
+   spec = (fftw_complex *) fftw_malloc(n_bins * sizeof(fftw_complex));
+   work = (fftw_complex *) fftw_malloc(n_bins * sizeof(fftw_complex));
+
+   p = fftw_plan_dft_r2c_3d(sizes[0], sizes[1], sizes[2], real_data, spec, fft_planner);
+   init_voxel_converter(&conv, in_vol);
+   for(i = 0; i < sizes[0]; i++){
+      for(j = 0; j < sizes[1]; j++){
+         get_volume_row(&conv, in_vol, i, j, &real_data[(i * sizes[1] + j) * sizes[2]]);
+         }
+      }
+   fftw_execute(p);
+   fftw_destroy_plan(p);
+
+   /* one inverse plan for every output */
+   p = fftw_plan_dft_c2r_3d(sizes[0], sizes[1], sizes[2], work, real_data, fft_planner);
+   divisor = (double) sizes[0] * sizes[1] * sizes[2];
+
+   dim_names = get_volume_dimension_names(in_vol);
+   for(op = 0; op < N_DERIVATIVES; op++){
+      out_vols[op] = NULL;
+      if(!wanted[op]){
+         continue;
+         }
+
+      /* apply the multiplier */
+      idx = 0;
+      for(i = 0; i < sizes[0]; i++){
+         for(j = 0; j < sizes[1]; j++){
+            for(k = 0; k < half; k++){
+               m[0] = (i <= sizes[0] / 2) ? i : i - sizes[0];
+               m[1] = (j <= sizes[1] / 2) ? j : j - sizes[1];
+               m[2] = k;
+
+               /* odd derivatives of the Nyquist bins are not defined */
+               if(op <= DERIV_GRAD_Z){
+                  for(d = 0; d < 3; d++){
+                     if(sizes[d] % 2 == 0 && abs(m[d]) == sizes[d] / 2){
+                        m[d] = 0;
+                        }
+                     }
+                  }
+
+               for(d = 0; d < 3; d++){
+                  kappa[d] = 2.0 * M_PI * m[d] / sizes[d];
+                  }
+               for(c = 0; c < 3; c++){
+                  w[c] = w_mat[c][0] * kappa[0] + w_mat[c][1] * kappa[1] + w_mat[c][2] * kappa[2];
+                  }
+               w2 = w[0] * w[0] + w[1] * w[1] + w[2] * w[2];
+
+               mult_re = mult_im = 0.0;
+               switch (op){
+               case DERIV_GRAD_X:
+               case DERIV_GRAD_Y:
+               case DERIV_GRAD_Z:
+                  mult_im = w[op - DERIV_GRAD_X];
+                  break;
+               case DERIV_LAPLACIAN:
+                  mult_re = -w2;
+                  break;
+               case DERIV_INV_LAPLACIAN:
+                  mult_re = (idx == 0 || w2 <= 0.0) ? 0.0 : -1.0 / w2;
+                  break;
+                  }
+
+               re = c_re(spec[idx]);
+               im = c_im(spec[idx]);
+               c_re(work[idx]) = (re * mult_re - im * mult_im) / divisor;
+               c_im(work[idx]) = (re * mult_im + im * mult_re) / divisor;
+               idx++;
+               }
+            }
+         }
+
+      fftw_execute(p);
+
+      /* define the output VIO_Volume */
+      out_vols[op] = create_volume(3, dim_names, NC_FLOAT, TRUE, 0.0, 0.0);
+      set_volume_sizes(out_vols[op], sizes);
+      set_volume_starts(out_vols[op], starts);
+      set_volume_separations(out_vols[op], separations);
+      for(d = 0; d < 3; d++){
+         set_volume_direction_cosine(out_vols[op], d, dircos[d]);
+         }
+      alloc_volume_data(out_vols[op]);
+
+      for(i = 0; i < sizes[0]; i++){
+         for(j = 0; j < sizes[1]; j++){
+            row = &real_data[(i * sizes[1] + j) * sizes[2]];
+            set_volume_row(out_vols[op], i, j, row, 1.0);
+            }
+         }
+      calc_volume_range(out_vols[op]);
+      }
+   delete_dimension_names(in_vol, dim_names);
+
+   /* be tidy */
+   fftw_destroy_plan(p);
+   fftw_free(real_data);
+   fftw_free(spec);
+   fftw_free(work);
+
+   return (VIO_OK);
+   }
@@ -17,9 +17,36 @@
 #define   OUTPUT_PHASE           6
 #define   OUTPUT_POWER           7
 
+#define   FFT_TYPE_DFT           0
+#define   FFT_TYPE_DCT           1
+#define   FFT_TYPE_DST           2
+
+#define   N_DERIVATIVES          5
+#define   DERIV_GRAD_X           0
+#define   DERIV_GRAD_Y           1
+#define   DERIV_GRAD_Z           2
+#define   DERIV_LAPLACIAN        3
+#define   DERIV_INV_LAPLACIAN    4
+
+void set_fft_planner_measure(int measure);
+unsigned get_fft_planner_flags(void);
+VIO_Real proj_value(VIO_Real real, VIO_Real imag, int job);
 VIO_Status prep_volume(VIO_Volume *in_vol, VIO_Volume *out_vol, char *frequency_dimorder[]);
 VIO_Status proj_volume(VIO_Volume *in_vol, VIO_Volume *out_vol, nc_type dtype, char *spatial_dimorder[], int job);
 VIO_Status fft_volume(VIO_Volume data, int inverse_flg, int dim, int centre);
 
+VIO_Status prep_real_volume(VIO_Volume *in_vol, VIO_Volume *out_vol, char *spatial_dimorder[]);
+VIO_Status r2r_volume(VIO_Volume data, int type, int inverse_flg, int dim);
+void calc_volume_range(VIO_Volume data);
+VIO_Status resample_volume(VIO_Volume *data, int new_sizes[]);
+int is_hermitian_volume(VIO_Volume data, int dim);
+VIO_Status fft_volume_c2r(VIO_Volume *data, int dim, int centre);
+
+int fft_friendly_size(int n, int even);
+int same_volume_grid(VIO_Volume a, VIO_Volume b);
+int find_bounding_box(VIO_Volume data, VIO_Real threshold, int lo[], int hi[]);
+VIO_Status crop_volume(VIO_Volume *data, int lo[], int hi[], int margin, int even);
+VIO_Status derivative_volumes(VIO_Volume in_vol, int wanted[], VIO_Volume out_vols[]);
+
 
 #endif
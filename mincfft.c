@@ -25,7 +25,13 @@
 #include <ParseArgv.h>
 #include <time_stamp.h>
 #include <ctype.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "fft_support.h"
+#include "fft_server.h"
+#include "fft_cache.h"
+#include "fft_local.h"
 
 #define ISSPACE(ch) (isspace((int)ch))
 #define ARG_SEPARATOR ','
@@ -33,6 +39,11 @@
 /* function prototypes */
 static void print_version_info(void);
 static int get_dimorder(char *dst, char *key, char *nextArg);
+static int get_resample_sizes(char *dst, char *key, char *nextArg);
+static int mincfft_main(int argc, char *argv[]);
+static int get_cache_key(char key[CACHE_KEY_LEN], char *in_fn);
+static long job_memory(int argc, char *argv[]);
+static ArgvInfo *find_option(char *arg);
 
 /* hack for pretty-printing */
 static char *out_names[MAX_OUTFILES] = {
@@ -46,11 +57,39 @@ static char *out_names[MAX_OUTFILES] = {
    "power    "
    };
 
+static char *deriv_names[N_DERIVATIVES] = {
+   "grad_x   ",
+   "grad_y   ",
+   "grad_z   ",
+   "laplacian",
+   "inv_lapl "
+   };
+
+static char *fft_type_names[] = {
+   "DFT",
+   "DCT",
+   "DST"
+   };
+
 static int verbose = FALSE;
 static int clobber = FALSE;
 static int inv_fft = FALSE;
 static int centre_fft = FALSE;
+static int hermitian = FALSE;
 static int fft_dim = 3;
+static int fft_type = FFT_TYPE_DFT;
+static int resample_to[3] = { 0, 0, 0 };
+static double resample_factor = 0.0;
+static char *crop_mode = NULL;
+static char *crop_mask = NULL;
+static double crop_threshold = -DBL_MAX;
+static int crop_margin = 2;
+static char *deriv_files[N_DERIVATIVES] = { NULL, NULL, NULL, NULL, NULL };
+static char *local_features = NULL;
+static int local_window = 16;
+static int local_stride = 4;
+static char *cache_dir = NULL;
+static double cache_size = CACHE_DEFAULT_SIZE;
 static char *outfiles[MAX_OUTFILES] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
 static int is_signed = FALSE;
 static nc_type dtype = NC_FLOAT;
@@ -96,6 +135,12 @@ static ArgvInfo argTable[] = {
     "Do a 2D FFT."},
    {"-3D", ARGV_CONSTANT, (char *)3, (char *)&fft_dim,
     "Do a 3D FFT (Default)."},
+   {"-dft", ARGV_CONSTANT, (char *)FFT_TYPE_DFT, (char *)&fft_type,
+    "Do a complex discrete Fourier transform (Default)."},
+   {"-dct", ARGV_CONSTANT, (char *)FFT_TYPE_DCT, (char *)&fft_type,
+    "Do a discrete cosine transform (DCT-II, inverse DCT-III).\n\t\tResult is real with no vector dimension."},
+   {"-dst", ARGV_CONSTANT, (char *)FFT_TYPE_DST, (char *)&fft_type,
+    "Do a discrete sine transform (DST-II, inverse DST-III).\n\t\tResult is real with no vector dimension."},
    {"-forward", ARGV_CONSTANT, (char *)FALSE, (char *)&inv_fft,
     "Calculate the forward FFT (default)."},
    {"-inverse", ARGV_CONSTANT, (char *)TRUE, (char *)&inv_fft,
@@ -104,6 +149,50 @@ static ArgvInfo argTable[] = {
     "Re-orient quadrants to force resulting data to the centre"},
    {"-center", ARGV_CONSTANT, (char *)TRUE, (char *)&centre_fft,
     "Synonym for our North American friends"},
+   {"-hermitian", ARGV_CONSTANT, (char *)TRUE, (char *)&hermitian,
+    "Input spectrum is Hermitian, -inverse writes real volumes directly.\n\t\tThis is detected when no complex outputs are requested."},
+
+   {NULL, ARGV_HELP, NULL, NULL, "\nCropping options (3D input only)"},
+   {"-crop", ARGV_STRING, (char *)1, (char *)&crop_mode,
+    "<auto> Crop to the bounding box of voxels above -crop_threshold before the FFT."},
+   {"-crop_mask", ARGV_STRING, (char *)1, (char *)&crop_mask,
+    "<mask.mnc> Crop to the bounding box of a mask before the FFT."},
+   {"-crop_threshold", ARGV_FLOAT, (char *)1, (char *)&crop_threshold,
+    "<value> Threshold for -crop auto.\n\t\t[Default: 10% of the input range above the minimum]"},
+   {"-crop_margin", ARGV_INT, (char *)1, (char *)&crop_margin,
+    "<voxels> Margin to add around the bounding box."},
+
+   {NULL, ARGV_HELP, NULL, NULL, "\nFourier resampling options (3D)"},
+   {"-resample_to", ARGV_FUNC, (char *) get_resample_sizes, (char *)resample_to,
+    "<nx,ny,nz> Resample to these sizes by zero-filling or truncating k-space\n\t\t(fastest varying dimension first)."},
+   {"-resample_factor", ARGV_FLOAT, (char *)1, (char *)&resample_factor,
+    "<f> Resample all dimensions by this factor via k-space (not with -centre)."},
+
+   {NULL, ARGV_HELP, NULL, NULL, "\nSpectral derivatives (3D input only, real outputs)"},
+   {"-grad_x", ARGV_STRING, (char *)1, (char *)&deriv_files[DERIV_GRAD_X],
+    "<file.mnc> Gradient along world x."},
+   {"-grad_y", ARGV_STRING, (char *)1, (char *)&deriv_files[DERIV_GRAD_Y],
+    "<file.mnc> Gradient along world y."},
+   {"-grad_z", ARGV_STRING, (char *)1, (char *)&deriv_files[DERIV_GRAD_Z],
+    "<file.mnc> Gradient along world z."},
+   {"-laplacian", ARGV_STRING, (char *)1, (char *)&deriv_files[DERIV_LAPLACIAN],
+    "<file.mnc> Laplacian."},
+   {"-inv_laplacian", ARGV_STRING, (char *)1, (char *)&deriv_files[DERIV_INV_LAPLACIAN],
+    "<file.mnc> Inverse Laplacian (zero mean solution of Poisson's equation)."},
+
+   {NULL, ARGV_HELP, NULL, NULL, "\nLocal spectrum options (3D input only)"},
+   {"-local_features", ARGV_STRING, (char *)1, (char *)&local_features,
+    "<file.mnc> Texture features of the spectra of windowed patches (float).\n\t\tvector_dimension: dominant frequency (cycles/mm), low, mid and\n\t\thigh band power fractions and spectral anisotropy."},
+   {"-local_window", ARGV_INT, (char *)1, (char *)&local_window,
+    "<voxels> Size of the (cubic) patches."},
+   {"-local_stride", ARGV_INT, (char *)1, (char *)&local_stride,
+    "<voxels> Step between patches, the feature volume is this much coarser."},
+
+   {NULL, ARGV_HELP, NULL, NULL, "\nResult cache options"},
+   {"-cache", ARGV_STRING, (char *)1, (char *)&cache_dir,
+    "<dir> Reuse results for the same input and options from this directory."},
+   {"-cache_size", ARGV_FLOAT, (char *)1, (char *)&cache_size,
+    "<MB> Size limit of the cache, least recently used results are removed."},
 
    {NULL, ARGV_HELP, NULL, NULL, "\nOutput file types for FFT"},
    {"-both", ARGV_STRING, (char *)1, (char *)&outfiles[OUTPUT_REAL_AND_IMAG],
@@ -131,6 +220,18 @@ char *def_spatial_dimorder[] = { MIzspace, MIyspace, MIxspace };
 char *def_frequency_dimorder[] = { MIzspace, MIyspace, MIxspace, MIvector_dimension };
 
 int main(int argc, char *argv[]){
+
+   /* resident server mode, jobs arrive from mincfft_client */
+   /* plans are measured, the wisdom is shared with later jobs  */
+   if(argc > 2 && strcmp(argv[1], "--serve") == 0){
+      set_fft_planner_measure(TRUE);
+      return serve_jobs(argv[2], argc - 2, &argv[2], mincfft_main, job_memory);
+      }
+
+   return mincfft_main(argc, argv);
+   }
+
+static int mincfft_main(int argc, char *argv[]){
    char *in_fn;
    char *history;
    VIO_Status status;
@@ -140,6 +241,13 @@ int main(int argc, char *argv[]){
    int c;
    int in_ndims;
    int n_outfiles;
+   int n_derivs;
+   int deriv_wanted[N_DERIVATIVES];
+   int do_resample;
+   int do_c2r;
+   int is_real;
+   int use_cache;
+   char cache_key[CACHE_KEY_LEN];
    VIO_Real min;
    VIO_Real max;
    minc_input_options in_ops;
@@ -179,7 +287,32 @@ int main(int argc, char *argv[]){
          n_outfiles++;
          }
       }
-   if(n_outfiles == 0){
+   n_derivs = 0;
+   for(c = 0; c < N_DERIVATIVES; c++){
+      deriv_wanted[c] = (deriv_files[c] != NULL);
+      if(deriv_wanted[c]){
+         if(!clobber && file_exists(deriv_files[c])){
+            fprintf(stderr, "%s: File %s exists, use -clobber to overwrite.\n", argv[0],
+                    deriv_files[c]);
+            exit(EXIT_FAILURE);
+            }
+         n_derivs++;
+         }
+      }
+   if(local_features != NULL && !clobber && file_exists(local_features)){
+      fprintf(stderr, "%s: File %s exists, use -clobber to overwrite.\n", argv[0],
+              local_features);
+      exit(EXIT_FAILURE);
+      }
+   if(crop_mode != NULL && strcmp(crop_mode, "auto") != 0){
+      fprintf(stderr, "%s: Unknown -crop mode %s (only auto is supported).\n", argv[0], crop_mode);
+      exit(EXIT_FAILURE);
+      }
+   if(crop_mask != NULL && !file_exists(crop_mask)){
+      fprintf(stderr, "%s: Couldn't find mask file %s.\n", argv[0], crop_mask);
+      exit(EXIT_FAILURE);
+      }
+   if(n_outfiles == 0 && n_derivs == 0 && local_features == NULL){
       fprintf(stderr, "%s: You should specify at least one outfile!\n", argv[0]);
       exit(EXIT_FAILURE);
       }
@@ -218,18 +351,173 @@ int main(int argc, char *argv[]){
       o_spatial_dimorder[2] = o_dimorder[2];
       }
 
+   if(crop_margin < 0){
+      fprintf(stderr, "%s: -crop_margin must not be negative.\n", argv[0]);
+      exit(EXIT_FAILURE);
+      }
+
+   /* real-to-real transforms work on real data only */
+   if(fft_type != FFT_TYPE_DFT && centre_fft){
+      fprintf(stderr, "%s: -centre cannot be used with -dct or -dst.\n", argv[0]);
+      exit(EXIT_FAILURE);
+      }
+
+   /* Fourier resampling is a forward and inverse 3D DFT in one */
+   do_resample = (resample_to[0] > 0 || resample_factor > 0.0);
+   if(do_resample && (fft_type != FFT_TYPE_DFT || fft_dim != 3 || inv_fft)){
+      fprintf(stderr, "%s: -resample_to and -resample_factor only work with a forward 3D DFT.\n",
+              argv[0]);
+      exit(EXIT_FAILURE);
+      }
+   if(do_resample && centre_fft){
+      fprintf(stderr, "%s: -centre cannot be used with -resample_to or -resample_factor.\n",
+              argv[0]);
+      exit(EXIT_FAILURE);
+      }
+
+   /* hand back stored results if this input and these options were seen */
+   use_cache = FALSE;
+   if(cache_dir != NULL && local_features == NULL && n_derivs == 0){
+      use_cache = get_cache_key(cache_key, in_fn);
+      if(!use_cache){
+         fprintf(stderr, "%s: Couldn't hash %s, not using the cache.\n", argv[0], in_fn);
+         }
+      else if(cache_fetch(cache_dir, cache_key, outfiles, MAX_OUTFILES)){
+         if(verbose){
+            fprintf(stdout, " | Cache hit:      %s/%s\n", cache_dir, cache_key);
+            }
+         return (EXIT_SUCCESS);
+         }
+      }
+
    /* read in the input file */
    in_ndims = get_minc_file_n_dimensions(in_fn);
    set_default_minc_input_options(&in_ops);
    set_minc_input_vector_to_scalar_flag(&in_ops, FALSE);
    if(in_ndims == 4){
+      if(fft_type != FFT_TYPE_DFT || crop_mode != NULL || crop_mask != NULL ||
+         local_features != NULL || n_derivs > 0){
+         fprintf(stderr, "%s: -dct, -dst, cropping, derivatives and local spectra require a 3D (real) input volume.\n",
+                 argv[0]);
+         exit(EXIT_FAILURE);
+         }
       status = input_volume(in_fn, 4, frequency_dimorder,
                             NC_UNSPECIFIED, FALSE, 0.0, 0.0, TRUE, &data, &in_ops);
       }
    else{
       status = input_volume(in_fn, 3, spatial_dimorder,
                             NC_UNSPECIFIED, FALSE, 0.0, 0.0, TRUE, &tmp, &in_ops);
-      status &= prep_volume(&tmp, &data, frequency_dimorder);
+
+      /* shrink the input to the occupied bounding box */
+      if(status == VIO_OK && (crop_mode != NULL || crop_mask != NULL)){
+         VIO_Volume mask;
+         int lo[3], hi[3];
+         int sizes[3];
+         int found;
+
+         if(crop_mask != NULL){
+            if(input_volume(crop_mask, 3, spatial_dimorder,
+                            NC_UNSPECIFIED, FALSE, 0.0, 0.0, TRUE, &mask, NULL) != VIO_OK){
+               fprintf(stderr, "Problems reading: %s\n", crop_mask);
+               exit(EXIT_FAILURE);
+               }
+            if(!same_volume_grid(tmp, mask)){
+               fprintf(stderr, "%s: %s must have the same sizes, starts, steps and direction cosines as %s.\n",
+                       argv[0], crop_mask, in_fn);
+               exit(EXIT_FAILURE);
+               }
+            found = find_bounding_box(mask, 0.5, lo, hi);
+            delete_volume(mask);
+            }
+         else{
+            if(crop_threshold == -DBL_MAX){
+               get_volume_real_range(tmp, &min, &max);
+               crop_threshold = min + 0.1 * (max - min);
+               }
+            found = find_bounding_box(tmp, crop_threshold, lo, hi);
+            }
+
+         if(!found){
+            fprintf(stderr, "%s: Nothing to crop to in %s.\n", argv[0],
+                    (crop_mask != NULL) ? crop_mask : in_fn);
+            exit(EXIT_FAILURE);
+            }
+
+         status = crop_volume(&tmp, lo, hi, crop_margin, centre_fft);
+
+         if(verbose){
+            get_volume_sizes(tmp, sizes);
+            fprintf(stdout, " | Cropped to:     %dx%dx%d (box %d:%d,%d:%d,%d:%d)\n",
+                    sizes[2], sizes[1], sizes[0],
+                    lo[2], hi[2], lo[1], hi[1], lo[0], hi[0]);
+            }
+         }
+
+      /* local spectra come from the input itself, not the working volume */
+      if(status == VIO_OK && local_features != NULL){
+         VIO_Volume features;
+
+         if(verbose){
+            fprintf(stdout, " | Local spectra:  %d^3 window, stride %d => %s\n",
+                    local_window, local_stride, local_features);
+            }
+
+         if(local_spectra_volume(tmp, &features, local_window, local_stride,
+                                 frequency_dimorder) != VIO_OK){
+            print_error("Problems calculating local spectra of: %s", in_fn);
+            exit(EXIT_FAILURE);
+            }
+         if(output_modified_volume(local_features, NC_FLOAT, FALSE, 0, 0,
+                                   features, in_fn, history, NULL) != VIO_OK){
+            print_error("Problems outputing: %s", local_features);
+            }
+         delete_volume(features);
+         }
+
+      /* derivatives share one forward FFT of the input */
+      if(status == VIO_OK && n_derivs > 0){
+         VIO_Volume derivs[N_DERIVATIVES];
+
+         if(derivative_volumes(tmp, deriv_wanted, derivs) != VIO_OK){
+            print_error("Problems calculating derivatives of: %s", in_fn);
+            exit(EXIT_FAILURE);
+            }
+         for(c = 0; c < N_DERIVATIVES; c++){
+            if(derivs[c] != NULL){
+               if(o_dimorder[0] != NULL){
+                  VIO_Volume reordered;
+
+                  proj_volume(&derivs[c], &reordered, dtype, o_spatial_dimorder, OUTPUT_REAL);
+                  delete_volume(derivs[c]);
+                  derivs[c] = reordered;
+                  }
+               if(verbose){
+                  get_volume_real_range(derivs[c], &min, &max);
+                  fprintf(stdout, "Outputting %s (%s) \t=> | range: [%g:%g]\n",
+                          deriv_names[c], deriv_files[c], min, max);
+                  }
+               if(output_modified_volume(deriv_files[c], dtype, is_signed, 0, 0,
+                                         derivs[c], in_fn, history, NULL) != VIO_OK){
+                  print_error("Problems outputing: %s", deriv_files[c]);
+                  }
+               delete_volume(derivs[c]);
+               }
+            }
+         }
+
+      /* nothing else to do */
+      if(status == VIO_OK && n_outfiles == 0){
+         delete_volume(tmp);
+         return (EXIT_SUCCESS);
+         }
+
+      /* real-to-real transforms and resampling keep the data real */
+      if(fft_type != FFT_TYPE_DFT || do_resample){
+         status &= prep_real_volume(&tmp, &data, spatial_dimorder);
+         }
+      else{
+         status &= prep_volume(&tmp, &data, frequency_dimorder);
+         }
       delete_volume(tmp);
       }
 
@@ -238,6 +526,18 @@ int main(int argc, char *argv[]){
       exit(EXIT_FAILURE);
       }
 
+   /* inverse of a Hermitian spectrum is real, use a complex-to-real FFT */
+   do_c2r = FALSE;
+   if(inv_fft && fft_type == FFT_TYPE_DFT && get_volume_n_dimensions(data) == 4){
+      if(hermitian){
+         do_c2r = TRUE;
+         }
+      else if(outfiles[OUTPUT_REAL_AND_IMAG] == NULL &&
+              outfiles[OUTPUT_IMAG] == NULL && outfiles[OUTPUT_PHASE] == NULL){
+         do_c2r = is_hermitian_volume(data, fft_dim);
+         }
+      }
+
    if(verbose){
       VIO_Real min_value, max_value;
 
@@ -254,10 +554,48 @@ int main(int argc, char *argv[]){
             }
          }
       fprintf(stdout, " | FFT order:      %d\n", fft_dim);
+      fprintf(stdout, " | Transform:      %s%s\n", fft_type_names[fft_type],
+              (do_c2r) ? " (complex to real)" : "");
       }
 
    /* FFT the volume */
-   if(fft_volume(data, inv_fft, fft_dim, centre_fft) != VIO_OK){
+   if(do_resample){
+      int sizes[4];
+      int new_sizes[3];
+
+      get_volume_sizes(data, sizes);
+      for(c = 0; c < 3; c++){
+         if(resample_to[0] > 0){
+            new_sizes[c] = resample_to[2 - c];
+            }
+         else{
+            new_sizes[c] = (int)(sizes[c] * resample_factor + 0.5);
+            if(new_sizes[c] < 1){
+               new_sizes[c] = 1;
+               }
+            }
+         }
+
+      if(verbose){
+         fprintf(stdout, " | Resample:       %dx%dx%d => %dx%dx%d\n",
+                 sizes[2], sizes[1], sizes[0], new_sizes[2], new_sizes[1], new_sizes[0]);
+         }
+
+      if(resample_volume(&data, new_sizes) != VIO_OK){
+         print_error("Problems during resampling of: %s", in_fn);
+         }
+      }
+   else if(do_c2r){
+      if(fft_volume_c2r(&data, fft_dim, centre_fft) != VIO_OK){
+         print_error("Problems during FFT of: %s", in_fn);
+         }
+      }
+   else if(fft_type != FFT_TYPE_DFT){
+      if(r2r_volume(data, fft_type, inv_fft, fft_dim) != VIO_OK){
+         print_error("Problems during %s of: %s", fft_type_names[fft_type], in_fn);
+         }
+      }
+   else if(fft_volume(data, inv_fft, fft_dim, centre_fft) != VIO_OK){
       print_error("Problems during FFT of: %s", in_fn);
       }
 
@@ -270,41 +608,19 @@ int main(int argc, char *argv[]){
             fflush(stdout);
             }
 
-         /* do the projection if neccesarry */
+         /* do the projection if neccesarry, real results (positional, */
+         /* -both or -real) are written directly unless they must be    */
+         /* reordered for -o_dimorder                                   */
          tmp = NULL;
-         if(c == OUTPUT_REAL_AND_IMAG){
-            VIO_Real value;
-            int i, j, k, l;
-            int sizes[4];
-
-            get_volume_sizes(data, sizes);
-
-            /* set up max and min values */
-            min = DBL_MAX;
-            max = -DBL_MAX;
-            for(i = sizes[0]; i--;){
-               for(j = sizes[1]; j--;){
-                  for(k = sizes[2]; k--;){
-                     for(l = sizes[3]; l--;){
-
-                        GET_VALUE_4D(value, data, i, j, k, l);
-                        if(value > max){
-                           max = value;
-                           }
-                        if(value < min){
-                           min = value;
-                           }
-                        }
-                     }
-                  }
-               }
-
-            set_volume_real_range(data, min, max);
-
+         is_real = (get_volume_n_dimensions(data) == 3);
+         if((c == OUTPUT_REAL_AND_IMAG && !is_real) ||
+            ((c == OUTPUT_REAL_AND_IMAG || c == OUTPUT_REAL) && is_real && o_dimorder[0] == NULL)){
+            calc_volume_range(data);
             vol_ptr = &data;
             }
          else{
-            status = proj_volume(&data, &tmp, dtype, o_spatial_dimorder, c);
+            status = proj_volume(&data, &tmp, dtype, o_spatial_dimorder,
+                                 (is_real && c == OUTPUT_REAL_AND_IMAG) ? OUTPUT_REAL : c);
             vol_ptr = &tmp;
             }
 
@@ -318,6 +634,9 @@ int main(int argc, char *argv[]){
                                     *vol_ptr, in_fn, history, NULL) != VIO_OK){
             print_error("Problems outputing: %s", outfiles[c]);
             }
+         else if(use_cache){
+            cache_store(cache_dir, cache_key, c, outfiles[c]);
+            }
 
          if(tmp != NULL){
             delete_volume(tmp);
@@ -326,10 +645,205 @@ int main(int argc, char *argv[]){
       }
 
 
+   if(use_cache){
+      cache_evict(cache_dir, cache_size);
+      }
+
    delete_volume(data);
    return (status);
    }
 
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : get_cache_key
+@INPUT      : in_fn - input file
+@OUTPUT     : key - cache key
+@RETURNS    : TRUE on success
+@DESCRIPTION: hashes the input volume (voxels and geometry) along with every
+              option that changes the result of a given output kind.
+ */
+static int get_cache_key(char key[CACHE_KEY_LEN], char *in_fn){
+   uint64_t hash;
+   char opts[1024];
+   int c, complex_out;
+
+   /* the inverse picks c2r on Hermitian input unless complex outputs are wanted */
+   complex_out = (outfiles[OUTPUT_REAL_AND_IMAG] != NULL ||
+                  outfiles[OUTPUT_IMAG] != NULL || outfiles[OUTPUT_PHASE] != NULL);
+
+   snprintf(opts, sizeof(opts),
+            "%s dim=%d type=%d inv=%d centre=%d herm=%d cplx=%d "
+            "resample=%d,%d,%d,%.17g crop=%s,%.17g,%d dtype=%d signed=%d",
+            PACKAGE_VERSION, fft_dim, fft_type, inv_fft, centre_fft, hermitian,
+            (inv_fft) ? complex_out : 0,
+            resample_to[0], resample_to[1], resample_to[2], resample_factor,
+            (crop_mode != NULL) ? crop_mode : "", crop_threshold, crop_margin,
+            (int)dtype, is_signed);
+
+   cache_hash_init(&hash);
+   cache_hash_string(&hash, opts);
+   for(c = 0; dimorder[c] != NULL; c++){
+      cache_hash_string(&hash, dimorder[c]);
+      }
+   cache_hash_string(&hash, "|");
+   for(c = 0; o_dimorder[c] != NULL; c++){
+      cache_hash_string(&hash, o_dimorder[c]);
+      }
+   cache_hash_string(&hash, "|");
+
+   if(!cache_hash_volume(&hash, in_fn)){
+      return FALSE;
+      }
+   if(crop_mask != NULL && !cache_hash_volume(&hash, crop_mask)){
+      return FALSE;
+      }
+
+   cache_key_string(hash, key);
+   return TRUE;
+   }
+
+/* rough estimate of the memory (bytes) a job will need, used by the server */
+static long job_memory(int argc, char *argv[]){
+   int c, n_derivs, n_threads;
+   int sizes[MAX_VAR_DIMS];
+   int in_ndims;
+   int to[3];
+   int window, stride;
+   double factor;
+   double n_values, n_voxels, n_new, n_patches;
+   double stage, peak;
+   char *in_fn, *features;
+   ArgvInfo *opt;
+   VIO_Volume header;
+
+   /* pick out the options that change the memory needed without parsing, */
+   /* the job itself still has to see (and report on) its own arguments   */
+   in_fn = NULL;
+   features = NULL;
+   n_derivs = 0;
+   to[0] = to[1] = to[2] = 0;
+   factor = 0.0;
+   window = local_window;
+   stride = local_stride;
+   for(c = 1; c < argc; c++){
+      if(argv[c][0] != '-'){
+         if(in_fn == NULL){
+            in_fn = argv[c];
+            }
+         continue;
+         }
+      opt = find_option(argv[c]);
+      if(opt == NULL || opt->type == ARGV_CONSTANT || c + 1 >= argc){
+         continue;
+         }
+      c++;
+
+      if(opt->dst == (char *)&resample_factor){
+         factor = atof(argv[c]);
+         }
+      else if(opt->dst == (char *)resample_to){
+         sscanf(argv[c], "%d,%d,%d", &to[0], &to[1], &to[2]);
+         }
+      else if(opt->dst == (char *)&local_features){
+         features = argv[c];
+         }
+      else if(opt->dst == (char *)&local_window){
+         window = atoi(argv[c]);
+         }
+      else if(opt->dst == (char *)&local_stride){
+         stride = atoi(argv[c]);
+         }
+      else if(opt->dst >= (char *)&deriv_files[0] &&
+              opt->dst < (char *)&deriv_files[N_DERIVATIVES]){
+         n_derivs++;
+         }
+      }
+
+   if(in_fn == NULL || !file_exists(in_fn)){
+      return 0;
+      }
+   in_ndims = get_minc_file_n_dimensions(in_fn);
+   if(in_ndims < 3 || in_ndims > 4 ||
+      input_volume_header_only(in_fn, in_ndims, NULL, &header, NULL) != VIO_OK){
+      return 0;
+      }
+   get_volume_sizes(header, sizes);
+   delete_volume(header);
+
+   /* a 4D input is complex, its vector_dimension has two values */
+   n_values = 1.0;
+   for(c = 0; c < in_ndims; c++){
+      n_values *= sizes[c];
+      }
+   n_voxels = (in_ndims == 4) ? n_values / 2.0 : n_values;
+
+   /* the largest of the stages below runs on top of the input (as floats) */
+   peak = 0.0;
+
+   /* complex working volume, FFTW buffer and an output projection */
+   stage = n_voxels * (2 * sizeof(float) + 2 * sizeof(double) + sizeof(float));
+
+   /* resampling holds both spectra, the real result and the new volume */
+   if(factor > 0.0 || to[0] > 0){
+      n_new = 1.0;
+      for(c = 0; c < 3; c++){
+         n_new *= (to[0] > 0) ? to[c] : (int)(sizes[c] * factor + 0.5);
+         }
+      stage = n_voxels * (sizeof(float) + 2 * sizeof(double)) +
+              n_new * (2 * sizeof(double) + sizeof(double) + 2 * sizeof(float) + sizeof(float));
+      }
+   peak = (stage > peak) ? stage : peak;
+
+   /* derivatives: real input, spectrum, work spectrum and one volume each */
+   if(n_derivs > 0){
+      stage = n_voxels * (sizeof(double) + 2 * 2 * sizeof(double) + n_derivs * sizeof(float));
+      peak = (stage > peak) ? stage : peak;
+      }
+
+   /* local spectra: the input as doubles, features twice and per-thread batches */
+   if(features != NULL && window > 0 && stride > 0){
+      n_patches = 1.0;
+      for(c = 0; c < 3; c++){
+         n_patches *= (sizes[c] >= window) ? (sizes[c] - window) / stride + 1 : 0;
+         }
+#ifdef _OPENMP
+      n_threads = omp_get_max_threads();
+#else
+      n_threads = 1;
+#endif
+      stage = n_voxels * sizeof(double) +
+              n_patches * LOCAL_N_FEATURES * (sizeof(double) + sizeof(float)) +
+              (n_threads + 1.0) * LOCAL_BATCH * window * window * window *
+              (sizeof(double) + 2 * sizeof(double));
+      peak = (stage > peak) ? stage : peak;
+      }
+
+   return (long)(n_values * sizeof(float) + peak);
+   }
+
+/* the argTable entry for an option, as ParseArgv matches them (the full */
+/* key or an unambiguous prefix of it), NULL if there is none            */
+static ArgvInfo *find_option(char *arg){
+   ArgvInfo *opt, *match;
+   size_t len;
+
+   len = strlen(arg);
+   match = NULL;
+   for(opt = argTable; opt->type != ARGV_END; opt++){
+      if(opt->key == NULL || strncmp(opt->key, arg, len) != 0){
+         continue;
+         }
+      if(strlen(opt->key) == len){
+         return opt;
+         }
+      if(match != NULL){
+         return NULL;
+         }
+      match = opt;
+      }
+
+   return match;
+   }
+
 void print_version_info(void){
    fprintf(stdout, "%s version %s\n", PACKAGE_NAME, PACKAGE_VERSION);
    fprintf(stdout, "Comments to %s\n", PACKAGE_BUGREPORT);
@@ -394,3 +908,30 @@ static int get_dimorder(char *dst, char *key, char *nextArg){
 
    return TRUE;
    }
+
+
+/* get resampling sizes (<nx>,<ny>,<nz>) from a ParseArgv string */
+static int get_resample_sizes(char *dst, char *key, char *nextArg){
+   int *sizes;
+
+   /* Get pointer to client data */
+   sizes = (int *) dst;
+
+   /* Check for next argument */
+   if(nextArg == NULL){
+      (void) fprintf(stderr,
+                     "\"%s\" option requires an additional argument\n",
+                     key);
+      exit(EXIT_FAILURE);
+      }
+
+   if(sscanf(nextArg, "%d,%d,%d", &sizes[0], &sizes[1], &sizes[2]) != 3 ||
+      sizes[0] < 1 || sizes[1] < 1 || sizes[2] < 1){
+      (void) fprintf(stderr,
+                     "\"%s\" option requires three sizes (<nx>,<ny>,<nz>)\n",
+                     key);
+      exit(EXIT_FAILURE);
+      }
+
+   return TRUE;
+   }
@@ -0,0 +1,127 @@
+/* mincfft_client.c                                                          */
+/*                                                                           */
+/* Hands a mincfft job to a resident server (mincfft --serve <socket>).      */
+/* Takes the same arguments as mincfft so it can replace it in scripts, the  */
+/* socket is given by the MINCFFT_SOCKET environment variable.               */
+/*                                                                           */
+/* Andrew Janke - a.janke@gmail.com                                          */
+/* Center for Magnetic Resonance                                             */
+/* University of Queensland                                                  */
+/*                                                                           */
+/* Copyright Andrew Janke, The University of Queensland & Louis Collins,     */
+/* Montreal Neurological Institute, Canada.                                  */
+/* Permission to use, copy, modify, and distribute this software and its     */
+/* documentation for any purpose and without fee is hereby granted,          */
+/* provided that the above copyright notice appear in all copies.  The       */
+/* author and the University of Queensland make no representations about the */
+/* suitability of this software for any purpose.  It is provided "as is"     */
+/* without express or implied warranty.                                      */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "fft_server.h"
+
+int main(int argc, char *argv[]){
+   int      c, fd, code, verbose;
+   int      fds[2];
+   ssize_t  n;
+   char    *socket_path;
+   char     cwd[PATH_MAX];
+   char     trailer[128];
+   int      trailer_len;
+   double   seconds;
+   struct sockaddr_un addr;
+   struct msghdr msg;
+   struct iovec iov;
+   struct cmsghdr *cmsg;
+   union {
+      char     buf[CMSG_SPACE(sizeof(fds))];
+      struct cmsghdr align;
+      } control;
+
+   socket_path = getenv(SERVER_SOCKET_ENV);
+   if(socket_path == NULL || strlen(socket_path) >= sizeof(addr.sun_path)){
+      fprintf(stderr, "%s: set %s to the socket of a running mincfft --serve\n",
+              argv[0], SERVER_SOCKET_ENV);
+      exit(EXIT_FAILURE);
+      }
+   if(getcwd(cwd, sizeof(cwd)) == NULL){
+      fprintf(stderr, "%s: cannot get the current directory: %s\n", argv[0], strerror(errno));
+      exit(EXIT_FAILURE);
+      }
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, socket_path);
+
+   fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+      fprintf(stderr, "%s: cannot connect to %s: %s\n", argv[0], socket_path, strerror(errno));
+      exit(EXIT_FAILURE);
+      }
+
+   /* send the request, cwd and args each NUL terminated then an empty string, */
+   /* our stdout and stderr go with the cwd so the job can write to them      */
+   verbose = 0;
+   fds[0] = STDOUT_FILENO;
+   fds[1] = STDERR_FILENO;
+   iov.iov_base = cwd;
+   iov.iov_len = strlen(cwd) + 1;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control.buf;
+   msg.msg_controllen = sizeof(control.buf);
+   cmsg = CMSG_FIRSTHDR(&msg);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+   memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+   if(sendmsg(fd, &msg, 0) < 0 || write(fd, "mincfft", strlen("mincfft") + 1) < 0){
+      fprintf(stderr, "%s: cannot send job: %s\n", argv[0], strerror(errno));
+      exit(EXIT_FAILURE);
+      }
+   for(c = 1; c < argc; c++){
+      if(write(fd, argv[c], strlen(argv[c]) + 1) < 0){
+         fprintf(stderr, "%s: cannot send job: %s\n", argv[0], strerror(errno));
+         exit(EXIT_FAILURE);
+         }
+      if(strcmp(argv[c], "-verbose") == 0){
+         verbose = 1;
+         }
+      }
+   if(write(fd, "", 1) < 0){
+      fprintf(stderr, "%s: cannot send job: %s\n", argv[0], strerror(errno));
+      exit(EXIT_FAILURE);
+      }
+
+   /* the job writes its output itself, wait for the status trailer */
+   trailer_len = 0;
+   while(trailer_len < (int) sizeof(trailer) - 1 &&
+         (n = read(fd, trailer + trailer_len, sizeof(trailer) - 1 - trailer_len)) > 0){
+      trailer_len += n;
+      }
+   close(fd);
+   trailer[trailer_len] = '\0';
+
+   if(trailer_len < 1 || trailer[0] != SERVER_STATUS_MARKER ||
+      sscanf(&trailer[1], "status %d %lf", &code, &seconds) != 2){
+      fprintf(stderr, "%s: lost connection to the server\n", argv[0]);
+      exit(EXIT_FAILURE);
+      }
+
+   if(verbose){
+      fprintf(stdout, "Job took %.3f seconds\n", seconds);
+      }
+
+   return (code);
+   }
@@ -0,0 +1,412 @@
+/* mincfft_mpi.c                                                             */
+/*                                                                           */
+/* A widget for FFT'ing MINC data that will not fit on one node              */
+/*                                                                           */
+/* The 3D FFT is distributed over MPI ranks by z slab using FFTW's MPI       */
+/* interface. Each rank reads its own slab of the input and writes its own   */
+/* slab of each output, the volume is never gathered onto one rank. Without  */
+/* parallel HDF5 the output slabs are written rank by rank, not at once.     */
+/*                                                                           */
+/*    mpirun -np 4 mincfft_mpi in.mnc out.mnc -magnitude mag.mnc             */
+/*                                                                           */
+/* Andrew Janke - a.janke@gmail.com                                          */
+/* Center for Magnetic Resonance                                             */
+/* University of Queensland                                                  */
+/*                                                                           */
+/* Copyright Andrew Janke, The University of Queensland & Louis Collins,     */
+/* Montreal Neurological Institute, Canada.                                  */
+/* Permission to use, copy, modify, and distribute this software and its     */
+/* documentation for any purpose and without fee is hereby granted,          */
+/* provided that the above copyright notice appear in all copies.  The       */
+/* author and the University of Queensland make no representations about the */
+/* suitability of this software for any purpose.  It is provided "as is"     */
+/* without express or implied warranty.                                      */
+
+
+#include <float.h>
+#include <math.h>
+#include <mpi.h>
+#include <fftw3-mpi.h>
+#include <volume_io.h>
+#include <ParseArgv.h>
+#include <time_stamp.h>
+#include "fft_support.h"
+
+/* definitions to support fftw2 complex data type operations in fftw3 */
+#define c_re(c) ((c)[0])
+#define c_im(c) ((c)[1])
+
+/* function prototypes */
+static void print_version_info(void);
+static void abort_job(int rank, char *msg, char *fn);
+static void write_slab(char *out_fn, char *history, int job,
+                       midimhandle_t *in_dims, int in_ndims, misize_t *sizes,
+                       fftw_complex *data, ptrdiff_t local_n0, ptrdiff_t local_0_start,
+                       int rank, int n_ranks);
+
+/* hack for pretty-printing */
+static char *out_names[MAX_OUTFILES] = {
+   "real+imag",
+   "real     ",
+   "imag     ",
+   "magnitude",
+   "magln    ",
+   "mag10    ",
+   "phase    ",
+   "power    "
+   };
+
+static int verbose = FALSE;
+static int clobber = FALSE;
+static int inv_fft = FALSE;
+static int centre_fft = FALSE;
+static char *outfiles[MAX_OUTFILES] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+
+static ArgvInfo argTable[] = {
+   {NULL, ARGV_HELP, (char *)NULL, (char *)NULL,
+    "General options:"},
+   {"-version", ARGV_FUNC, (char *)print_version_info, (char *)NULL,
+    "print version info and exit"},
+   {"-verbose", ARGV_CONSTANT, (char *)TRUE, (char *)&verbose,
+    "Print out extra information."},
+   {"-clobber", ARGV_CONSTANT, (char *)TRUE, (char *)&clobber,
+    "Clobber existing files."},
+
+   {NULL, ARGV_HELP, NULL, NULL, "\nFFT options (3D only, zspace,yspace,xspace order)"},
+   {"-forward", ARGV_CONSTANT, (char *)FALSE, (char *)&inv_fft,
+    "Calculate the forward FFT (default)."},
+   {"-inverse", ARGV_CONSTANT, (char *)TRUE, (char *)&inv_fft,
+    "Calculate the inverse FFT."},
+   {"-centre", ARGV_CONSTANT, (char *)TRUE, (char *)&centre_fft,
+    "Re-orient quadrants to force resulting data to the centre"},
+   {"-center", ARGV_CONSTANT, (char *)TRUE, (char *)&centre_fft,
+    "Synonym for our North American friends"},
+
+   {NULL, ARGV_HELP, NULL, NULL, "\nOutput file types for FFT (written rank by rank)"},
+   {"-both", ARGV_STRING, (char *)1, (char *)&outfiles[OUTPUT_REAL_AND_IMAG],
+    "<file.mnc> Complex Real and Imaginary data (default)."},
+   {"-real", ARGV_STRING, (char *)1, (char *)&outfiles[OUTPUT_REAL],
+    "<file.mnc> Real component of data."},
+   {"-imaginary", ARGV_STRING, (char *)1, (char *)&outfiles[OUTPUT_IMAG],
+    "<file.mnc> Imaginary component of data."},
+   {"-magnitude", ARGV_STRING, (char *)1, (char *)&outfiles[OUTPUT_MAGNITUDE],
+    "<file.mnc> magnitude of Real and Imaginary data."},
+   {"-magln", ARGV_STRING, (char *)1, (char *)&outfiles[OUTPUT_MAGLN],
+    "<file.mnc> ln magnitude of Real and Imaginary data."},
+   {"-mag10", ARGV_STRING, (char *)1, (char *)&outfiles[OUTPUT_MAG10],
+    "<file.mnc> log 10 magnitude of Real and Imaginary data."},
+   {"-phase", ARGV_STRING, (char *)1, (char *)&outfiles[OUTPUT_PHASE],
+    "<file.mnc> phase of Real and Imaginary data."},
+   {"-power", ARGV_STRING, (char *)1, (char *)&outfiles[OUTPUT_POWER],
+    "<file.mnc> power spectrum."},
+
+   {NULL, ARGV_HELP, NULL, NULL, ""},
+   {NULL, ARGV_END, NULL, NULL, NULL}
+   };
+
+static char *def_dimorder[] = { MIzspace, MIyspace, MIxspace, MIvector_dimension };
+
+int main(int argc, char *argv[]){
+   char *in_fn;
+   char *history;
+   int c, rank, n_ranks;
+   int in_ndims;
+   int n_outfiles;
+   misize_t sizes[4];
+   misize_t start[4];
+   misize_t count[4];
+   ptrdiff_t local_alloc, local_n0, local_0_start;
+   ptrdiff_t m, n_local;
+   long i, j, k;
+   double factor, divisor;
+   double *slab;
+   mihandle_t in_vol;
+   midimhandle_t in_dims[4];
+   fftw_complex *data;
+   fftw_plan p;
+
+   MPI_Init(&argc, &argv);
+   fftw_mpi_init();
+   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+   MPI_Comm_size(MPI_COMM_WORLD, &n_ranks);
+
+   /* get the history string */
+   history = time_stamp(argc, argv);
+
+   /* get args, every rank parses the same command line */
+   if(ParseArgv(&argc, argv, argTable, 0) || (argc < 2)){
+      if(rank == 0){
+         fprintf(stderr,
+                 "\nUsage: mpirun -np <n> %s [<options>] <infile.mnc> [-outtype <type.mnc>] [<outfile.mnc>]\n",
+                 argv[0]);
+         fprintf(stderr, "       %s [-help]\n\n", argv[0]);
+         }
+      MPI_Finalize();
+      exit(EXIT_FAILURE);
+      }
+   in_fn = argv[1];
+   if(argc > 2){
+      outfiles[OUTPUT_REAL_AND_IMAG] = argv[2];
+      }
+
+   /* check for infile and outfiles */
+   if(!file_exists(in_fn)){
+      abort_job(rank, "Couldn't find input file", in_fn);
+      }
+   n_outfiles = 0;
+   for(c = 0; c < MAX_OUTFILES; c++){
+      if(outfiles[c] != NULL){
+         if(!clobber && file_exists(outfiles[c])){
+            abort_job(rank, "File exists, use -clobber to overwrite", outfiles[c]);
+            }
+         n_outfiles++;
+         }
+      }
+   if(n_outfiles == 0){
+      abort_job(rank, "You should specify at least one outfile!", "");
+      }
+
+   /* open the input file, 3D real or 4D complex (vector_dimension of 2) */
+   if(miopen_volume(in_fn, MI2_OPEN_READ, &in_vol) != MI_NOERROR ||
+      miget_volume_dimension_count(in_vol, MI_DIMCLASS_ANY, MI_DIMATTR_ALL, &in_ndims) != MI_NOERROR ||
+      (in_ndims != 3 && in_ndims != 4) ||
+      miset_apparent_dimension_order_by_name(in_vol, in_ndims, def_dimorder) != MI_NOERROR ||
+      miget_volume_dimensions(in_vol, MI_DIMCLASS_ANY, MI_DIMATTR_ALL, MI_DIMORDER_APPARENT,
+                              in_ndims, in_dims) != MI_NOERROR ||
+      miget_dimension_sizes(in_dims, in_ndims, sizes) != MI_NOERROR ||
+      (in_ndims == 4 && sizes[3] != 2)){
+      abort_job(rank, "Problems reading (need zspace,yspace,xspace[,vector_dimension])", in_fn);
+      }
+
+   /* check that sizes are even if shifting to centre */
+   if(centre_fft && (sizes[0] % 2 != 0 || sizes[1] % 2 != 0 || sizes[2] % 2 != 0)){
+      abort_job(rank, "all lengths must be even if using -centre", in_fn);
+      }
+
+   /* our share of the volume, a slab of local_n0 slices */
+   local_alloc = fftw_mpi_local_size_3d(sizes[0], sizes[1], sizes[2], MPI_COMM_WORLD,
+                                        &local_n0, &local_0_start);
+   n_local = local_n0 * sizes[1] * sizes[2];
+   data = (fftw_complex *) fftw_malloc(((local_alloc > 0) ? local_alloc : 1) * sizeof(fftw_complex));
+
+   if(verbose && rank == 0){
+      fprintf(stdout, " | Input file:     %s\n", in_fn);
+      fprintf(stdout, " | Input ndims:    %d\n", in_ndims);
+      fprintf(stdout, " | sizes:          %ldx%ldx%ld\n",
+              (long) sizes[2], (long) sizes[1], (long) sizes[0]);
+      fprintf(stdout, " | Ranks:          %d\n", n_ranks);
+      fprintf(stdout, " | Output files:\n");
+      for(c = 0; c < MAX_OUTFILES; c++){
+         if(outfiles[c] != NULL){
+            fprintf(stdout, " |   [%d]:         %s => %s\n", c, out_names[c],
+               outfiles[c]);
+            }
+         }
+      }
+   if(verbose){
+      fprintf(stdout, " | rank %d:         slices %ld to %ld\n", rank,
+              (long) local_0_start, (long) (local_0_start + local_n0 - 1));
+      }
+
+   /* mincfft fills its FFT buffer last voxel first, so to give the same  */
+   /* results buffer slice i is voxel slice n0-1-i and each slab is read */
+   /* from the mirror image position and reversed                        */
+   if(n_local > 0){
+      start[0] = sizes[0] - local_0_start - local_n0;
+      start[1] = start[2] = start[3] = 0;
+      count[0] = local_n0;
+      count[1] = sizes[1];
+      count[2] = sizes[2];
+      count[3] = 2;
+
+      slab = (double *) malloc(n_local * ((in_ndims == 4) ? 2 : 1) * sizeof(double));
+      if(miget_real_value_hyperslab(in_vol, MI_TYPE_DOUBLE, start, count, slab) != MI_NOERROR){
+         abort_job(rank, "Problems reading", in_fn);
+         }
+
+      /* do the super-funky shift to centre calculation if required */
+      factor = 1.0;
+      for(m = 0; m < n_local; m++){
+         i = (n_local - 1 - m) / (sizes[1] * sizes[2]);
+         j = ((n_local - 1 - m) / sizes[2]) % sizes[1];
+         k = (n_local - 1 - m) % sizes[2];
+         if(centre_fft){
+            factor = ((start[0] + i + j + k) % 2) ? -1.0 : 1.0;
+            }
+
+         if(in_ndims == 4){
+            c_re(data[m]) = slab[2 * (n_local - 1 - m)] * factor;
+            c_im(data[m]) = slab[2 * (n_local - 1 - m) + 1] * factor;
+            }
+         else{
+            c_re(data[m]) = slab[n_local - 1 - m] * factor;
+            c_im(data[m]) = 0.0;
+            }
+         }
+      free(slab);
+      }
+
+   /* do the FFT, output stays in slabs (no transposed output) */
+   p = fftw_mpi_plan_dft_3d(sizes[0], sizes[1], sizes[2], data, data, MPI_COMM_WORLD,
+                            (inv_fft) ? FFTW_BACKWARD : FFTW_FORWARD, FFTW_ESTIMATE);
+   fftw_execute(p);
+   fftw_destroy_plan(p);
+
+   if(inv_fft){
+      divisor = (double) sizes[0] * sizes[1] * sizes[2];
+      for(m = 0; m < n_local; m++){
+         c_re(data[m]) /= divisor;
+         c_im(data[m]) /= divisor;
+         }
+      }
+
+   /* output the resulting volume(s), each rank writes its own slab */
+   for(c = 0; c < MAX_OUTFILES; c++){
+      if(outfiles[c] != NULL){
+         if(verbose && rank == 0){
+            fprintf(stdout, "Outputting %s (%s)\n", out_names[c], outfiles[c]);
+            }
+         write_slab(outfiles[c], history, c, in_dims, in_ndims, sizes,
+                    data, local_n0, local_0_start, rank, n_ranks);
+         }
+      }
+
+   /* the input dimension handles are used by write_slab, close only now */
+   miclose_volume(in_vol);
+
+   /* be tidy */
+   fftw_free(data);
+   fftw_mpi_cleanup();
+   MPI_Finalize();
+   return (EXIT_SUCCESS);
+   }
+
+/* report an error from rank 0 and take everyone down */
+static void abort_job(int rank, char *msg, char *fn){
+   if(rank == 0){
+      fprintf(stderr, "mincfft_mpi: %s %s\n", msg, fn);
+      }
+   MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+   exit(EXIT_FAILURE);
+   }
+
+/* ----------------------------- MNI Header -----------------------------------
+@NAME       : write_slab
+@INPUT      : out_fn - output file, created by rank 0
+              job - OUTPUT_* type to write
+              in_dims, in_ndims, sizes - input dimensions (apparent order)
+              data - this rank's slab of the transform
+              local_n0, local_0_start - slab position (buffer order)
+@DESCRIPTION: the global range is agreed with an MPI_Allreduce, then the
+              ranks take turns to open the file and write their slab.
+              HDF5 files cannot be written by several processes at once
+              without parallel HDF5, so the writes are ordered but no data
+              is ever moved between ranks.
+ */
+static void write_slab(char *out_fn, char *history, int job,
+                       midimhandle_t *in_dims, int in_ndims, misize_t *sizes,
+                       fftw_complex *data, ptrdiff_t local_n0, ptrdiff_t local_0_start,
+                       int rank, int n_ranks){
+   int c, r, out_ndims;
+   ptrdiff_t m, n_local;
+   misize_t start[4];
+   misize_t count[4];
+   double value, min, max, range[2], global_range[2];
+   double *slab;
+   mihandle_t out_vol;
+   midimhandle_t out_dims[4];
+
+   out_ndims = (job == OUTPUT_REAL_AND_IMAG) ? 4 : 3;
+   n_local = local_n0 * sizes[1] * sizes[2];
+
+   /* project (and reverse) our slab */
+   slab = (double *) malloc(((n_local > 0) ? n_local : 1) * ((out_ndims == 4) ? 2 : 1) * sizeof(double));
+   min = DBL_MAX;
+   max = -DBL_MAX;
+   for(m = 0; m < n_local; m++){
+      if(out_ndims == 4){
+         slab[2 * (n_local - 1 - m)] = c_re(data[m]);
+         slab[2 * (n_local - 1 - m) + 1] = c_im(data[m]);
+         value = (c_re(data[m]) < c_im(data[m])) ? c_re(data[m]) : c_im(data[m]);
+         if(value < min){
+            min = value;
+            }
+         value = (c_re(data[m]) > c_im(data[m])) ? c_re(data[m]) : c_im(data[m]);
+         if(value > max){
+            max = value;
+            }
+         }
+      else{
+         value = proj_value(c_re(data[m]), c_im(data[m]), job);
+         slab[n_local - 1 - m] = value;
+         if(value < min){
+            min = value;
+            }
+         if(value > max){
+            max = value;
+            }
+         }
+      }
+
+   /* agree on the range of the whole volume */
+   range[0] = -min;
+   range[1] = max;
+   MPI_Allreduce(range, global_range, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+   /* take turns writing, rank 0 creates the file */
+   start[0] = sizes[0] - local_0_start - local_n0;
+   start[1] = start[2] = start[3] = 0;
+   count[0] = local_n0;
+   count[1] = sizes[1];
+   count[2] = sizes[2];
+   count[3] = 2;
+   for(r = 0; r < n_ranks; r++){
+      if(rank == r){
+         if(r == 0){
+            for(c = 0; c < 3; c++){
+               micopy_dimension(in_dims[c], &out_dims[c]);
+               }
+            if(out_ndims == 4){
+               if(in_ndims == 4){
+                  micopy_dimension(in_dims[3], &out_dims[3]);
+                  }
+               else{
+                  micreate_dimension(MIvector_dimension, MI_DIMCLASS_RECORD,
+                                     MI_DIMATTR_REGULARLY_SAMPLED, 2, &out_dims[3]);
+                  }
+               }
+
+            if(micreate_volume(out_fn, out_ndims, out_dims, MI_TYPE_FLOAT, MI_CLASS_REAL,
+                               NULL, &out_vol) != MI_NOERROR ||
+               miset_slice_scaling_flag(out_vol, FALSE) != MI_NOERROR ||
+               micreate_volume_image(out_vol) != MI_NOERROR){
+               fprintf(stderr, "mincfft_mpi: Problems creating %s\n", out_fn);
+               MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+               }
+            miset_volume_range(out_vol, global_range[1], -global_range[0]);
+            miadd_history_attr(out_vol, strlen(history), history);
+            }
+         else if(miopen_volume(out_fn, MI2_OPEN_RDWR, &out_vol) != MI_NOERROR){
+            fprintf(stderr, "mincfft_mpi: rank %d cannot open %s\n", rank, out_fn);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+
+         if(n_local > 0 &&
+            miset_voxel_value_hyperslab(out_vol, MI_TYPE_DOUBLE, start, count, slab) != MI_NOERROR){
+            fprintf(stderr, "mincfft_mpi: rank %d problems writing %s\n", rank, out_fn);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+         miclose_volume(out_vol);
+         }
+      MPI_Barrier(MPI_COMM_WORLD);
+      }
+
+   free(slab);
+   }
+
+void print_version_info(void){
+   fprintf(stdout, "%s version %s\n", PACKAGE_NAME, PACKAGE_VERSION);
+   fprintf(stdout, "Comments to %s\n", PACKAGE_BUGREPORT);
+   fprintf(stdout, "\n");
+   exit(EXIT_SUCCESS);
+   }